@@ -52,6 +52,15 @@ namespace dae
 			return f0 + ((ColorRGB{1, 1, 1} - f0) * powf(1 - std::max(Vector3::Dot(h, v), 0.f), 5));
 		}
 
+		/**
+		 * \brief NormalDistribution_GGX with the squared(squared(roughness)) of the material precomputed
+		 */
+		static float NormalDistribution_GGX_AlphaSquared(const Vector3& n, const Vector3& h, float sqrA)
+		{
+			//Used std::max to prevent the result of the dotproduct going under 0
+			return sqrA / (PI * Square(Square(std::max(Vector3::Dot(n, h), 0.f)) * (sqrA - 1) + 1));
+		}
+
 		/**
 		 * \brief BRDF NormalDistribution >> Trowbridge-Reitz GGX (UE4 implemetation - squared(roughness))
 		 * \param n Surface normal
@@ -61,13 +70,21 @@ namespace dae
 		 */
 		static float NormalDistribution_GGX(const Vector3& n, const Vector3& h, float roughness)
 		{
-			const float a{ Square(roughness) };
-			const float sqrA{ Square(a) };
-			//Used std::max to prevent the result of the dotproduct going under 0
-			return sqrA / (PI * Square(Square(std::max(Vector3::Dot(n, h), 0.f)) * (Square(a) - 1) + 1));
+			return NormalDistribution_GGX_AlphaSquared(n, h, Square(Square(roughness)));
 		}
 
 
+		/**
+		 * \brief GeometryFunction_SchlickGGX with k (squared(squared(roughness) + 1) / 8) of the material precomputed
+		 */
+		static float GeometryFunction_SchlickGGX_K(const Vector3& n, const Vector3& v, float k)
+		{
+			//Used std::max to prevent the result of the dotproduct going under 0
+			const float clampedDot{ std::max(Vector3::Dot(n, v), 0.f) };
+			const float geometry{ clampedDot / ((clampedDot * (1 - k)) + k) };
+			return geometry;
+		}
+
 		/**
 		 * \brief BRDF Geometry Function >> Schlick GGX (Direct Lighting + UE4 implementation - squared(roughness))
 		 * \param n Normal of the surface
@@ -77,12 +94,7 @@ namespace dae
 		 */
 		static float GeometryFunction_SchlickGGX(const Vector3& n, const Vector3& v, float roughness)
 		{
-			const float a{ Square(roughness) };
-			const float k{ Square(a + 1) / 8 };
-			//Used std::max to prevent the result of the dotproduct going under 0
-			const float clampedDot{ std::max(Vector3::Dot(n, v), 0.f) };
-			const float geometry{ clampedDot / ((clampedDot * (1 - k)) + k) };
-			return geometry;
+			return GeometryFunction_SchlickGGX_K(n, v, Square(Square(roughness) + 1) / 8);
 		}
 
 		/**
@@ -98,5 +110,13 @@ namespace dae
 			return GeometryFunction_SchlickGGX(n, v, roughness) * GeometryFunction_SchlickGGX(n, l, roughness);
 		}
 
+		/**
+		 * \brief GeometryFunction_Smith with the Schlick GGX k of the material precomputed
+		 */
+		static float GeometryFunction_Smith_K(const Vector3& n, const Vector3& v, const Vector3& l, float k)
+		{
+			return GeometryFunction_SchlickGGX_K(n, v, k) * GeometryFunction_SchlickGGX_K(n, l, k);
+		}
+
 	}
 }
\ No newline at end of file
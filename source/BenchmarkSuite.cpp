@@ -0,0 +1,138 @@
+#include "BenchmarkSuite.h"
+#include "Renderer.h"
+#include "Scene.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <thread>
+
+using namespace dae;
+
+namespace
+{
+	struct SceneResult
+	{
+		std::string sceneName{};
+		double bvhBuildTime{}; //ms
+		double averageFrameTime{}; //ms
+		double minFrameTime{}; //ms
+		double maxFrameTime{}; //ms
+		uint64_t primaryRaysPerFrame{};
+		uint64_t shadowRaysPerFrame{};
+	};
+
+	bool WriteJSON(const BenchmarkSettings& settings, const Renderer& renderer, const std::vector<SceneResult>& results)
+	{
+		std::ofstream fileStream(settings.outputPath);
+		if (!fileStream) return false;
+
+		fileStream << "{\n"
+			<< "  \"width\": " << settings.width << ",\n"
+			<< "  \"height\": " << settings.height << ",\n"
+			<< "  \"warmupFrames\": " << settings.warmupFrames << ",\n"
+			<< "  \"frames\": " << settings.frameCount << ",\n"
+			<< "  \"threads\": " << renderer.GetThreadCount() << ",\n"
+			<< "  \"hardwareThreads\": " << std::thread::hardware_concurrency() << ",\n"
+			<< "  \"renderMode\": \"" << renderer.GetRenderModeName() << "\",\n"
+			<< "  \"lightingMode\": \"" << renderer.GetLightingModeName() << "\",\n"
+			<< "  \"shadows\": " << (renderer.AreShadowsEnabled() ? "true" : "false") << ",\n"
+			<< "  \"scenes\": [";
+		for (size_t resultIdx{}; resultIdx < results.size(); ++resultIdx)
+		{
+			const SceneResult& result{ results[resultIdx] };
+			const double framesPerSecond{ 1000. / result.averageFrameTime };
+			fileStream << (resultIdx == 0 ? "\n" : ",\n")
+				<< "    {\n"
+				<< "      \"name\": \"" << result.sceneName << "\",\n"
+				<< "      \"bvhBuildMs\": " << result.bvhBuildTime << ",\n"
+				<< "      \"msPerFrame\": " << result.averageFrameTime << ",\n"
+				<< "      \"minMsPerFrame\": " << result.minFrameTime << ",\n"
+				<< "      \"maxMsPerFrame\": " << result.maxFrameTime << ",\n"
+				<< "      \"primaryRaysPerFrame\": " << result.primaryRaysPerFrame << ",\n"
+				<< "      \"shadowRaysPerFrame\": " << result.shadowRaysPerFrame << ",\n"
+				<< "      \"primaryRaysPerSecond\": " << result.primaryRaysPerFrame * framesPerSecond << ",\n"
+				<< "      \"shadowRaysPerSecond\": " << result.shadowRaysPerFrame * framesPerSecond << "\n"
+				<< "    }";
+		}
+		fileStream << "\n  ]\n}\n";
+		return static_cast<bool>(fileStream);
+	}
+}
+
+bool dae::RunBenchmarkSuite(const BenchmarkSettings& settings)
+{
+	std::vector<std::string> sceneNames{ settings.sceneNames };
+	if (sceneNames.empty())
+	{
+		for (const std::string_view sceneName : GetSceneNames())
+		{
+			sceneNames.emplace_back(sceneName);
+		}
+	}
+	//Fail before spending minutes on the scenes in front of a typo
+	for (const std::string& sceneName : sceneNames)
+	{
+		if (std::find(GetSceneNames().begin(), GetSceneNames().end(), sceneName) == GetSceneNames().end())
+		{
+			std::cerr << "Unknown scene " << sceneName << std::endl;
+			return false;
+		}
+	}
+
+	Renderer renderer{ settings.width, settings.height };
+	renderer.SetThreadCount(settings.threadCount);
+	std::vector<uint32_t> pixels(static_cast<size_t>(settings.width) * settings.height);
+	const FrameBuffer target{ pixels.data(), settings.width, PixelFormat::RGBA8 };
+
+	std::vector<SceneResult> results{};
+	for (const std::string& sceneName : sceneNames)
+	{
+		const std::unique_ptr<Scene> pScene{ CreateScene(sceneName) };
+		pScene->Initialize();
+
+		SceneResult result{};
+		result.sceneName = sceneName;
+		result.bvhBuildTime = pScene->RebuildBVHs();
+
+		for (int frame{}; frame < settings.warmupFrames; ++frame)
+		{
+			renderer.Render(pScene.get(), target);
+		}
+		std::vector<double> frameTimes(settings.frameCount);
+		for (double& frameTime : frameTimes)
+		{
+			const auto start{ std::chrono::high_resolution_clock::now() };
+			renderer.Render(pScene.get(), target);
+			const auto end{ std::chrono::high_resolution_clock::now() };
+			frameTime = std::chrono::duration<double, std::milli>(end - start).count();
+		}
+		result.averageFrameTime = std::accumulate(frameTimes.begin(), frameTimes.end(), 0.) / settings.frameCount;
+		result.minFrameTime = *std::min_element(frameTimes.begin(), frameTimes.end());
+		result.maxFrameTime = *std::max_element(frameTimes.begin(), frameTimes.end());
+
+		pScene->CountRays(settings.width, settings.height, result.primaryRaysPerFrame, result.shadowRaysPerFrame);
+		if (!renderer.AreShadowsEnabled())
+		{
+			result.shadowRaysPerFrame = 0;
+		}
+
+		const double framesPerSecond{ 1000. / result.averageFrameTime };
+		std::cout << "Benchmark >> " << sceneName << " | BVH build ms: " << result.bvhBuildTime
+			<< " | ms/frame: " << result.averageFrameTime << " (min " << result.minFrameTime << ", max " << result.maxFrameTime << ")"
+			<< " | primary Mrays/s: " << result.primaryRaysPerFrame * framesPerSecond / 1e6
+			<< " | shadow Mrays/s: " << result.shadowRaysPerFrame * framesPerSecond / 1e6 << std::endl;
+		results.push_back(result);
+	}
+
+	if (!WriteJSON(settings, renderer, results))
+	{
+		std::cerr << "Something went wrong. Benchmark results not saved to " << settings.outputPath << std::endl;
+		return false;
+	}
+	std::cout << "Benchmark results saved to " << settings.outputPath << std::endl;
+	return true;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+//Standard includes
+#include <string>
+#include <vector>
+
+namespace dae
+{
+	struct BenchmarkSettings
+	{
+		std::vector<std::string> sceneNames{}; //Empty runs every built in scene
+		int width{ 640 };
+		int height{ 480 };
+		int warmupFrames{ 2 };
+		int frameCount{ 20 };
+		unsigned int threadCount{}; //0 uses one thread per hardware thread
+		std::string outputPath{ "benchmark.json" };
+	};
+
+	//Renders every scene from the camera it is initialized with, the scene is never updated so every frame of every run
+	//traces the same rays. Prints a line per scene and writes the results to the output path as JSON.
+	//Returns false for an unknown scene name or an output file that can't be written.
+	bool RunBenchmarkSuite(const BenchmarkSettings& settings);
+}
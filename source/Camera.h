@@ -1,15 +1,28 @@
 #pragma once
 #include <cassert>
-#include <SDL_keyboard.h>
-#include <SDL_mouse.h>
 
 #include "Math.h"
-#include "Timer.h"
 
 #include <iostream>
 
 namespace dae
 {
+	//Keyboard and mouse state of a frame, gathered by the window so the camera doesn't depend on it
+	struct CameraInput
+	{
+		bool isShiftPressed{};
+		bool isForwardsPressed{};
+		bool isBackwardsPressed{};
+		bool isRightPressed{};
+		bool isLeftPressed{};
+
+		//Relative mouse movement since the previous frame
+		int mouseX{};
+		int mouseY{};
+		bool isLeftMousePressed{};
+		bool isRightMousePressed{};
+	};
+
 	struct Camera
 	{
 		Camera() = default;
@@ -52,6 +65,19 @@ namespace dae
 			return cameraToWorld;
 		}
 
+		//Normalized direction of the primary ray through the center of pixel (px, py) of a width x height image,
+		//aspectRatio is width / height so callers only calculate it once per image.
+		//Every primary ray goes through here, so the renderer and the BVH profiling trace the same rays.
+		Vector3 GetPrimaryRayDirection(int px, int py, int width, int height, float aspectRatio) const
+		{
+			const float cx{ (2.f * ((px + 0.5f) / width) - 1) * aspectRatio * fov };
+			const float cy{ (1.f - (2.f * (py + 0.5f) / height)) * fov };
+
+			Vector3 direction{ cameraToWorld.TransformVector(cx, cy, 1) };
+			direction.Normalize();
+			return direction;
+		}
+
 		void SetCameraFOV(float degrees)
 		{
 			fovAngle = std::max(minFov, std::min(degrees, maxFov));
@@ -65,42 +91,35 @@ namespace dae
 			forwardChanged = true;
 		}
 
-		void Update(Timer* pTimer)
+		void Update(float deltaTime, const CameraInput& input)
 		{
 			//Set constants
-			const float deltaTime = pTimer->GetElapsed();
 			const float linearSpeed{ 4.f };
 			const float rotationSpeed{ 15.f };			
 
 			//Keyboard Input
-			const uint8_t* pKeyboardState = SDL_GetKeyboardState(nullptr);
-
-			const bool isShiftPressed{ pKeyboardState[SDL_SCANCODE_LSHIFT] || pKeyboardState[SDL_SCANCODE_RSHIFT] };			
-			const float shiftModifier{ 4.f * isShiftPressed + 1.f * !isShiftPressed };			
+			const float shiftModifier{ 4.f * input.isShiftPressed + 1.f * !input.isShiftPressed };			
 			const float speedModifier{ deltaTime * linearSpeed * shiftModifier };
 
-			const bool isForwardsPressed{ pKeyboardState[SDL_SCANCODE_W] || pKeyboardState[SDL_SCANCODE_UP] };
-			const bool isBackwardsPressed{ pKeyboardState[SDL_SCANCODE_S] || pKeyboardState[SDL_SCANCODE_DOWN] };
-			const bool isRightPressed{ pKeyboardState[SDL_SCANCODE_D] || pKeyboardState[SDL_SCANCODE_RIGHT] };
-			const bool isLeftPressed{ pKeyboardState[SDL_SCANCODE_A] || pKeyboardState[SDL_SCANCODE_LEFT] };
-			origin += forward * speedModifier * isForwardsPressed;
-			origin += forward * -speedModifier * isBackwardsPressed;
-			origin += right * speedModifier * isRightPressed;
-			origin += right * -speedModifier * isLeftPressed;
+			origin += forward * speedModifier * input.isForwardsPressed;
+			origin += forward * -speedModifier * input.isBackwardsPressed;
+			origin += right * speedModifier * input.isRightPressed;
+			origin += right * -speedModifier * input.isLeftPressed;
 
 			//Mouse Input
-			int mouseX{}, mouseY{};
-			const uint32_t mouseState = SDL_GetRelativeMouseState(&mouseX, &mouseY);
+			const int mouseX{ input.mouseX }, mouseY{ input.mouseY };
+			const bool isOnlyLeftPressed{ input.isLeftMousePressed && !input.isRightMousePressed };
+			const bool isOnlyRightPressed{ input.isRightMousePressed && !input.isLeftMousePressed };
 			const float rotationModifier{ deltaTime * rotationSpeed * shiftModifier };			
 			
 			//Calculate rotation & movement on mouse movement
 			if (mouseY != 0.f || mouseX != 0.f)
 			{
-				origin += forward * speedModifier * (mouseState == SDL_BUTTON_LMASK) * static_cast<float>(mouseY);
-				origin += Vector3::UnitY * speedModifier * (mouseState == (SDL_BUTTON_RMASK | SDL_BUTTON_LMASK)) * static_cast<float>(mouseY);
-				totalPitch -= static_cast<float>(mouseY) * TO_RADIANS * (mouseState == SDL_BUTTON_RMASK) * rotationModifier;
+				origin += forward * speedModifier * isOnlyLeftPressed * static_cast<float>(mouseY);
+				origin += Vector3::UnitY * speedModifier * (input.isLeftMousePressed && input.isRightMousePressed) * static_cast<float>(mouseY);
+				totalPitch -= static_cast<float>(mouseY) * TO_RADIANS * isOnlyRightPressed * rotationModifier;
 				totalYaw += static_cast<float>(mouseX) * TO_RADIANS *
-					(mouseState & SDL_BUTTON_LMASK || mouseState & SDL_BUTTON_RMASK) * rotationModifier;
+					(input.isLeftMousePressed || input.isRightMousePressed) * rotationModifier;
 				CalculateForwardVector();
 			}
 		}
@@ -1,12 +1,23 @@
 #pragma once
 #include <cassert>
+#include <cfloat>
 
 #include "Math.h"
+#include "ThreadPool.h"
 #include "vector"
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <numeric>
+#include <thread>
 
 #define BVH
 #define USE_BINS
+#define USE_TLAS
+#define USE_TRIANGLE_PACKETS
+#define PARALLEL_BUILD
 namespace dae
 {
 #pragma region GEOMETRY
@@ -40,18 +51,68 @@ namespace dae
 		axisZ
 	};
 
-	struct BVHNode
+	//32 bytes so two nodes share a cache line, leftFirst holds the left child for inner nodes
+	//and the first index for leaves (idxCount > 0)
+	struct alignas(32) BVHNode
 	{
 		Vector3 minAABB{ Vector3::MaxVector };
+		unsigned int leftFirst;
 		Vector3 maxAABB{ Vector3::MinVector };
-		unsigned int firstIdx;
 		unsigned int idxCount;
-		unsigned int leftNode;
-		bool IsLeaf() 
+		bool IsLeaf() const
 		{
 			return idxCount > 0;
 		};
 	};
+	static_assert(sizeof(BVHNode) == 32, "BVHNode should stay 32 bytes");
+
+	//Traversal stacks hold maxBVHDepth nodes. The builders never split a node at depth maxBVHDepth - 1, so a traversal
+	//has at most one pending sibling per level above the node it visits plus that node's two children on its stack.
+	constexpr unsigned int maxBVHDepth{ 64 };
+
+	//Wide BVH node collapsed from the binary BVH, child bounds are stored per axis (SoA)
+	//so all children can be slab tested in a single SIMD pass
+	template<int Width>
+	struct alignas(32) WideBVHNode
+	{
+		float minX[Width];
+		float minY[Width];
+		float minZ[Width];
+		float maxX[Width];
+		float maxY[Width];
+		float maxZ[Width];
+		unsigned int child[Width]; //Wide node index for inner children, first index for leaves
+		unsigned int idxCount[Width]; //0 for inner children
+		unsigned int childCount;
+	};
+
+	//Binned SAH gives good trees, the linear (Morton code) builder is meant for meshes that are rebuilt every frame
+	//and the spatial split builder (SBVH) trades build time and memory for the best trees on static meshes
+	enum class BVHBuilder
+	{
+		BinnedSAH,
+		LBVH,
+		SpatialSAH
+	};
+
+	enum class BVHLayout
+	{
+		Binary,
+		Wide4,
+		Wide8,
+		//Define layouts above
+		Count
+	};
+
+	//Order of the binary nodes in the pool, sibling pairs always stay next to each other.
+	//Creation order scatters the top of the tree, van Emde Boas keeps every subtree in a contiguous block of nodes
+	//and access frequency packs the nodes a profiled render visited most at the front of the pool.
+	enum class BVHNodeOrder
+	{
+		Creation,
+		VanEmdeBoas,
+		AccessFrequency
+	};
 
 	struct AABB
 	{
@@ -82,6 +143,102 @@ namespace dae
 		unsigned int idxCount{};
 	};
 
+	//Part of a triangle referenced by a node of the spatial split builder, a triangle can have several
+	struct BVHReference
+	{
+		AABB bounds{};
+		unsigned int triangleIdx{};
+	};
+
+	struct BVHSplit
+	{
+		float cost{ FLT_MAX };
+		int axis{};
+		float position{};
+		AABB leftBounds{};
+		AABB rightBounds{};
+	};
+
+	//Bounds of the part of a triangle between slabMin and slabMax on one axis, limited to the bounds of the reference
+	inline AABB ClipTriangleBounds(const Vector3& v0, const Vector3& v1, const Vector3& v2, int axis, float slabMin, float slabMax, const AABB& referenceBounds)
+	{
+		AABB bounds{};
+		const Vector3* vertices[3]{ &v0, &v1, &v2 };
+		for (int i{}; i < 3; ++i)
+		{
+			const Vector3& start{ *vertices[i] };
+			const Vector3& end{ *vertices[(i + 1) % 3] };
+			const float startPos{ start[axis] };
+			const float endPos{ end[axis] };
+			if (startPos >= slabMin && startPos <= slabMax)
+			{
+				bounds.Grow(start);
+			}
+
+			//Points where the edge crosses the slab planes
+			for (const float plane : { slabMin, slabMax })
+			{
+				if ((startPos < plane && endPos > plane) || (startPos > plane && endPos < plane))
+				{
+					Vector3 point{ start + (end - start) * ((plane - startPos) / (endPos - startPos)) };
+					point[axis] = plane;
+					bounds.Grow(point);
+				}
+			}
+		}
+
+		bounds.minAABB = Vector3::Max(bounds.minAABB, referenceBounds.minAABB);
+		bounds.maxAABB = Vector3::Min(bounds.maxAABB, referenceBounds.maxAABB);
+		return bounds;
+	}
+
+	//Spreads the lower 10 bits of value so there are two zero bits between every bit
+	inline unsigned int ExpandMortonBits(unsigned int value)
+	{
+		value = (value * 0x00010001u) & 0xFF0000FFu;
+		value = (value * 0x00000101u) & 0x0F00F00Fu;
+		value = (value * 0x00000011u) & 0xC30C30C3u;
+		value = (value * 0x00000005u) & 0x49249249u;
+		return value;
+	}
+
+	//30 bit Morton code of a position inside the unit cube
+	inline unsigned int MortonCode(const Vector3& position)
+	{
+		const unsigned int x{ static_cast<unsigned int>(std::clamp(position.x * 1024.f, 0.f, 1023.f)) };
+		const unsigned int y{ static_cast<unsigned int>(std::clamp(position.y * 1024.f, 0.f, 1023.f)) };
+		const unsigned int z{ static_cast<unsigned int>(std::clamp(position.z * 1024.f, 0.f, 1023.f)) };
+		return (ExpandMortonBits(x) << 2) | (ExpandMortonBits(y) << 1) | ExpandMortonBits(z);
+	}
+
+	//Persistent threads every BVH build runs on, one per hardware thread, started by the first parallel build
+	inline ThreadPool& GetBuildThreadPool()
+	{
+		static ThreadPool threadPool{};
+		return threadPool;
+	}
+
+	//Splits [0, count) into chunkCount contiguous ranges and runs function(chunkIdx, first, last) on each of them
+	//on the build thread pool, the call returns once all ranges are done. A single range runs on the calling thread.
+	template<typename Function>
+	void ParallelChunks(unsigned int count, unsigned int chunkCount, const Function& function)
+	{
+		chunkCount = std::max(1u, std::min(chunkCount, count));
+		if (chunkCount == 1)
+		{
+			function(0u, 0u, count);
+			return;
+		}
+
+		const unsigned int chunkSize{ (count + chunkCount - 1) / chunkCount };
+		GetBuildThreadPool().ParallelFor(chunkCount, 1, [&function, count, chunkSize](uint32_t chunkIdx)
+			{
+				const unsigned int first{ std::min(count, chunkIdx * chunkSize) };
+				const unsigned int last{ std::min(count, first + chunkSize) };
+				function(chunkIdx, first, last);
+			});
+	}
+
 	struct Triangle
 	{
 		Triangle() = default;
@@ -106,6 +263,54 @@ namespace dae
 		unsigned char materialIndex{};
 	};
 
+	//Triangle in the form used by the intersection test, the edges are baked in so they are not recalculated per test
+	struct BakedTriangle
+	{
+		BakedTriangle() = default;
+		BakedTriangle(const Vector3& _v0, const Vector3& _v1, const Vector3& _v2, const Vector3& _normal) :
+			v0{ _v0 }, edge1{ _v1 - _v0 }, edge2{ _v2 - _v0 }, normal{ _normal }{}
+
+		Vector3 v0{};
+		Vector3 edge1{};
+		Vector3 edge2{};
+		Vector3 normal{};
+	};
+
+	//Four baked triangles in SoA form for the SIMD leaf test, unused lanes are zeroed (degenerate) and never hit
+	struct alignas(16) TrianglePacket
+	{
+		static constexpr unsigned int width{ 4 };
+
+		float v0X[width]{};
+		float v0Y[width]{};
+		float v0Z[width]{};
+		float edge1X[width]{};
+		float edge1Y[width]{};
+		float edge1Z[width]{};
+		float edge2X[width]{};
+		float edge2Y[width]{};
+		float edge2Z[width]{};
+		float normalX[width]{};
+		float normalY[width]{};
+		float normalZ[width]{};
+
+		void SetLane(unsigned int lane, const BakedTriangle& triangle)
+		{
+			v0X[lane] = triangle.v0.x;
+			v0Y[lane] = triangle.v0.y;
+			v0Z[lane] = triangle.v0.z;
+			edge1X[lane] = triangle.edge1.x;
+			edge1Y[lane] = triangle.edge1.y;
+			edge1Z[lane] = triangle.edge1.z;
+			edge2X[lane] = triangle.edge2.x;
+			edge2Y[lane] = triangle.edge2.y;
+			edge2Z[lane] = triangle.edge2.z;
+			normalX[lane] = triangle.normal.x;
+			normalY[lane] = triangle.normal.y;
+			normalZ[lane] = triangle.normal.z;
+		}
+	};
+
 	struct TriangleMesh
 	{
 		TriangleMesh() = default;
@@ -116,20 +321,17 @@ namespace dae
 			CalculateNormals();
 
 			//Update Transforms
+			UpdateAABB();
 			UpdateTransforms();
 		}
 
 		TriangleMesh(const std::vector<Vector3>& _positions, const std::vector<int>& _indices, const std::vector<Vector3>& _normals, TriangleCullMode _cullMode) :
 			positions(_positions), indices(_indices), normals(_normals), cullMode(_cullMode)
 		{
+			UpdateAABB();
 			UpdateTransforms();
 		}
 
-		~TriangleMesh()
-		{
-			delete[] pBVHNodes;
-		}
-
 		std::vector<Vector3> positions{};
 		std::vector<Vector3> normals{};
 		std::vector<int> indices{};
@@ -141,18 +343,72 @@ namespace dae
 		Matrix translationTransform{};
 		Matrix scaleTransform{};
 
+		//Object space > world space and its inverse, rays are transformed into object space
+		//so the BVH only has to be built once for rigid transformations
+		Matrix worldTransform{};
+		Matrix inverseTransform{};
+		Matrix normalTransform{};
+
 		Vector3 minAABB;
 		Vector3 maxAABB;
 		Vector3 transformedMinAABB;
 		Vector3 transformedMaxAABB;
 
-		BVHNode* pBVHNodes{};
+		std::vector<BVHNode> bvhNodes{};
 		unsigned int rootNodeIdx{};
 		unsigned int nodesUsed{1};
-		const unsigned int leafSize{3 * 3 - 1};
-
-		std::vector<Vector3> transformedPositions{};
-		std::vector<Vector3> transformedNormals{};
+		//Maximum amount of triangles a leaf is allowed to keep without trying to split, one triangle packet
+		const unsigned int leafSize{ TrianglePacket::width };
+		//Nodes with at least this many triangles are binned on multiple threads
+		static constexpr unsigned int parallelBinThreshold{ 16384 };
+		//Subtrees with at least this many triangles are built as their own build pool task
+		static constexpr unsigned int parallelSubtreeThreshold{ 4096 };
+
+		//The linear builder can still use binned SAH for the top levels of the tree
+		BVHBuilder bvhBuilder{ BVHBuilder::BinnedSAH };
+		unsigned int lbvhSAHLevels{};
+
+		//Spatial splits may add duplicated references up to this fraction of the triangle count
+		float spatialSplitBudget{ 0.3f };
+		//Spatial splits are only tried when the children of the best object split overlap more than this part of the root area
+		static constexpr float spatialSplitOverlap{ 1e-5f };
+		//Below this depth the spatial split builder only splits by count, so large overlapping triangles can not use up maxBVHDepth
+		static constexpr unsigned int maxSpatialDepth{ 48 };
+		//Triangle each reference came from after a spatial split build, empty when nothing was duplicated
+		std::vector<unsigned int> referenceTriangles{};
+
+		//Refit rebuilds the tree once its SAH cost grows past this ratio of the cost right after the last build
+		float refitRebuildRatio{ 1.5f };
+		float bvhBuildCost{};
+
+		//Time in ms the tree rotations may spend improving a fresh tree, 0 disables them. Meant for static meshes.
+		float optimizationTimeBudget{};
+		float bvhUnoptimizedCost{};
+		float bvhOptimizationTime{};
+		//Levels below the root of the finished tree, always less than maxBVHDepth
+		unsigned int bvhDepth{};
+
+		//Applied after every build, access frequency falls back to van Emde Boas while there is no profile for the tree
+		BVHNodeOrder bvhNodeOrder{ BVHNodeOrder::VanEmdeBoas };
+		//Sibling pairs per access frequency treelet, 64 pairs of 32 byte nodes fill a 4 KiB page
+		static constexpr unsigned int bvhTreeletPairs{ 64 };
+
+		//Per triangle centroids, bounds and Morton codes, only alive during BuildBVH and partitioned along with the indices
+		std::vector<Vector3> buildCentroids{};
+		std::vector<AABB> buildBounds{};
+		std::vector<unsigned int> buildMortonCodes{};
+
+		//Collapsed copies of the binary BVH, the layout used for traversal can be switched at runtime
+		BVHLayout bvhLayout{ BVHLayout::Binary };
+		std::vector<WideBVHNode<4>> bvh4Nodes{};
+		std::vector<WideBVHNode<8>> bvh8Nodes{};
+
+		//Triangles in the order of the (reordered) indices, so every leaf is a contiguous range
+		std::vector<BakedTriangle> bakedTriangles{};
+
+		//Leaves packed per TrianglePacket::width triangles, leafPacketIdx maps the first triangle of a leaf to its first packet
+		std::vector<TrianglePacket> trianglePackets{};
+		std::vector<unsigned int> leafPacketIdx{};
 
 		void Translate(const Vector3& translation)
 		{
@@ -171,6 +427,7 @@ namespace dae
 
 		void AppendTriangle(const Triangle& triangle, bool ignoreTransformUpdate = false)
 		{
+			RemoveDuplicateReferences();
 			int startIndex = static_cast<int>(positions.size());
 
 			positions.push_back(triangle.v0);
@@ -183,13 +440,18 @@ namespace dae
 
 			normals.push_back(triangle.normal);
 
-			//Not ideal, but making sure all vertices are updated
-			if(!ignoreTransformUpdate)
+			//Not ideal, but making sure the bounds are updated
+			if (!ignoreTransformUpdate)
+			{
+				UpdateAABB();
 				UpdateTransforms();
+			}
 		}
 
+		//Face normal of every triangle in the current order of the indices, replaces the ones there were
 		void CalculateNormals()
 		{
+			normals.clear();
 			normals.reserve(indices.size() / 3);
 			const size_t idxIncr{ 3 };
 			for (size_t idx{}; idx < indices.size(); idx += idxIncr)
@@ -210,29 +472,14 @@ namespace dae
 		void UpdateTransforms()
 		{
 			//Calculate Final Transform 
-			const auto finalTransform = scaleTransform * rotationTransform * translationTransform;			
+			worldTransform = scaleTransform * rotationTransform * translationTransform;
+			inverseTransform = Matrix::Inverse(worldTransform);
 
+			//Normals are transformed with the inverse transpose to stay correct under non-uniform scaling
+			normalTransform = Matrix::Transpose(inverseTransform);
 
-			//Transform Positions (positions > transformedPositions)
-			transformedPositions.clear();
-			transformedPositions.reserve(positions.size());
-			for (auto& pos : positions)
-			{
-				transformedPositions.emplace_back(finalTransform.TransformPoint(pos));
-			}
-
-			//Transform Normals (normals > transformedNormals)
-			transformedNormals.clear();
-			transformedNormals.reserve(normals.size());
-			for (auto& normal : normals)
-			{
-				transformedNormals.emplace_back(finalTransform.TransformVector(normal).Normalized());
-			}			
-#ifdef BVH
-			BuildBVH();
-#else
-			UpdateTransformedAABB(finalTransform);
-#endif
+			//Only the world bounds change, positions and the BVH stay in object space
+			UpdateTransformedAABB(worldTransform);
 		}
 
 		void UpdateAABB()
@@ -291,223 +538,1313 @@ namespace dae
 		//BVH algorithm taken from: https://jacco.ompf2.com/2022/04/13/how-to-build-a-bvh-part-1-basics/
 		//Part 2: https://jacco.ompf2.com/2022/04/18/how-to-build-a-bvh-part-2-faster-rays/
 		//Part 3: https://jacco.ompf2.com/2022/04/21/how-to-build-a-bvh-part-3-quick-builds/
-		void BuildBVH()
+		void BuildBVH(unsigned int threadCount = std::thread::hardware_concurrency())
 		{			
-			BVHNode& root{ pBVHNodes[rootNodeIdx] };			
+#ifndef PARALLEL_BUILD
+			threadCount = 1;
+#endif
+			threadCount = std::max(threadCount, 1u);
+
+			//Start from the unique triangles again if a spatial split build duplicated some of them
+			RemoveDuplicateReferences();
+
+			const unsigned int triangleCount{ static_cast<unsigned int>(indices.size() / 3) };
+			bvhNodes.clear();
+			bvh4Nodes.clear();
+			bvh8Nodes.clear();
+			nodesUsed = 0;
+			bvhDepth = 0;
+			bakedTriangles.clear();
+			trianglePackets.clear();
+			leafPacketIdx.clear();
+			if (triangleCount == 0) return;
+
+			if (bvhBuilder == BVHBuilder::SpatialSAH)
+			{
+				BuildSpatialBVH();
+			}
+			else
+			{
+				//A binary tree over N triangles never needs more than 2N - 1 nodes
+				bvhNodes.resize(2 * triangleCount - 1);
 
-			root.leftNode = 0;
-			root.firstIdx = 0;
-			root.idxCount = static_cast<unsigned int>(indices.size());
+				BVHNode& root{ bvhNodes[rootNodeIdx] };
+				root.leftFirst = 0;
+				root.idxCount = static_cast<unsigned int>(indices.size());
 
-			//Reset nodesUsed to 1 to take into account the root node
-			nodesUsed = 1;
+				//Centroids and bounds are computed once and reused by every split
+				CalculateBuildData(threadCount);
+				if (bvhBuilder == BVHBuilder::LBVH)
+				{
+					CalculateMortonCodes(threadCount);
+				}
+
+				//Start the node counter at 1 to take into account the root node, subtrees built in parallel share it
+				std::atomic<unsigned int> nodeCounter{ 1 };
+
+				//Update Nodes
+				UpdateNodeBounds(rootNodeIdx, threadCount);
+				Subdivide(rootNodeIdx, nodeCounter, threadCount);
+				nodesUsed = nodeCounter;
+
+				buildCentroids.clear();
+				buildCentroids.shrink_to_fit();
+				buildBounds.clear();
+				buildBounds.shrink_to_fit();
+				buildMortonCodes.clear();
+				buildMortonCodes.shrink_to_fit();
+			}
+
+			//Trim the pool to the nodes that were actually used
+			bvhNodes.resize(nodesUsed);
+			bvhNodes.shrink_to_fit();
+
+			bvhUnoptimizedCost = CalculateSAHCost();
+			bvhOptimizationTime = 0.f;
+			if (optimizationTimeBudget > 0.f)
+			{
+				OptimizeBVH(optimizationTimeBudget);
+			}
+			bvhBuildCost = CalculateSAHCost();
+			bvhDepth = GetSubtreeHeight(rootNodeIdx);
+			assert(bvhDepth < maxBVHDepth);
+
+			//A profile of the previous tree does not match the new one
+			ReorderBVHNodes(bvhNodeOrder);
 
-			//Update Nodes
-			UpdateNodeBounds(rootNodeIdx);
-			Subdivide(rootNodeIdx);
+			CollapseBVH(bvh4Nodes);
+			CollapseBVH(bvh8Nodes);
+
+			BakeTriangles();
+			BakeTrianglePackets();
 		}
 
-		void UpdateNodeBounds(unsigned int nodeIdx)
+		//Recomputes the node bounds bottom-up after the positions moved, the topology of the tree is kept.
+		//Returns true when the SAH cost degraded too much and the tree was rebuilt instead.
+		bool Refit()
 		{
-			//Reset bounding box of the node
-			BVHNode& node{ pBVHNodes[nodeIdx] };
-			node.minAABB = Vector3::MaxVector;
-			node.maxAABB = Vector3::MinVector;
-			for (unsigned int i{ node.firstIdx }; i < (node.firstIdx + node.idxCount); ++i)
+			if (bvhNodes.empty()) return false;
+
+			RefitNode(rootNodeIdx);
+			//The faces turned along with the positions, the baked triangles copy these normals
+			CalculateNormals();
+
+			UpdateAABB();
+			UpdateTransforms();
+
+			if (CalculateSAHCost() > refitRebuildRatio * bvhBuildCost)
 			{
-				node.minAABB = Vector3::Min(node.minAABB, transformedPositions[indices[i]]);
-				node.maxAABB = Vector3::Max(node.maxAABB, transformedPositions[indices[i]]);
+				BuildBVH();
+				return true;
 			}
+
+			CollapseBVH(bvh4Nodes);
+			CollapseBVH(bvh8Nodes);
+
+			BakeTriangles();
+			BakeTrianglePackets();
+			return false;
 		}
 
-		void Subdivide(unsigned int nodeIdx)
+		//Post-order, so it does not depend on how the nodes are laid out in the pool
+		void RefitNode(unsigned int nodeIdx)
 		{
-			//Terminate Recursion if necessary
-			BVHNode& node = pBVHNodes[nodeIdx];
-			if (node.idxCount <= 8) return;
-
-			//Determine split axis
-#ifdef USE_BINS
-			int axis{ 0 };
-			float splitPos{};
-			const float splitCost{ FindBestSplitPlane(node, axis, splitPos)};
-			const float noSplitCost{ CalculateNodeCost(node) };
-			if (splitCost >= noSplitCost) return;
-#else
-			Vector3 extent{ node.maxAABB - node.minAABB };
-			int axis{ 0 };
-			if (extent.y > extent.x) axis = 1;
-			if (extent.z > extent[axis]) axis = 2;
-			float splitPos{ node.minAABB[axis] + extent[axis] * 0.5f };
-#endif
-			//Partitioning
-			int i{ static_cast<int>(node.firstIdx) };
-			int j{ i + static_cast<int>(node.idxCount) - 1 };
-			while (i <= j)
+			BVHNode& node{ bvhNodes[nodeIdx] };
+			AABB bounds{};
+			if (node.IsLeaf())
 			{
-				Vector3 centroid{ (transformedPositions[indices[i]] + transformedPositions[indices[i + 1]] + transformedPositions[indices[i + 2]]) * 0.3333f };
-				if (centroid[axis] < splitPos)
-				{
-					i += 3;
-				}
-				else
+				for (unsigned int i{ node.leftFirst }; i < node.leftFirst + node.idxCount; ++i)
 				{
-					std::swap(normals[i / 3], normals[(j - 2) / 3]);
-					std::swap(transformedNormals[i / 3], transformedNormals[(j - 2) / 3]);
-
-					std::swap(indices[i], indices[j - 2]);
-					std::swap(indices[i + 1], indices[j - 1]);
-					std::swap(indices[i + 2], indices[j]);
-					j -= 3;
+					bounds.Grow(positions[indices[i]]);
 				}
+				node.minAABB = bounds.minAABB;
+				node.maxAABB = bounds.maxAABB;
+				return;
 			}
 
-			int leftCount{ i - static_cast<int>(node.firstIdx) };
-			if (leftCount == 0 || leftCount == node.idxCount)
+			RefitNode(node.leftFirst);
+			RefitNode(node.leftFirst + 1);
+			UpdateNodeBoundsFromChildren(nodeIdx);
+		}
+
+		void UpdateNodeBoundsFromChildren(unsigned int nodeIdx)
+		{
+			BVHNode& node{ bvhNodes[nodeIdx] };
+			const BVHNode& leftNode{ bvhNodes[node.leftFirst] };
+			const BVHNode& rightNode{ bvhNodes[node.leftFirst + 1] };
+			node.minAABB = Vector3::Min(leftNode.minAABB, rightNode.minAABB);
+			node.maxAABB = Vector3::Max(leftNode.maxAABB, rightNode.maxAABB);
+		}
+
+		static float GetNodeArea(const BVHNode& node)
+		{
+			const Vector3 extent{ node.maxAABB - node.minAABB };
+			return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+		}
+
+		//SAH cost of the binary tree relative to the root area, traversing a node costs 1 and testing a triangle costs 1
+		float CalculateSAHCost() const
+		{
+			if (bvhNodes.empty()) return 0.f;
+
+			const float rootArea{ GetNodeArea(bvhNodes[rootNodeIdx]) };
+			if (rootArea <= 0.f) return 0.f;
+
+			float cost{};
+			for (const BVHNode& node : bvhNodes)
 			{
-				return;
+				cost += GetNodeArea(node) * (node.IsLeaf() ? static_cast<float>(node.idxCount / 3) : 1.f);
 			}
+			return cost / rootArea;
+		}
 
-			//Setting Data
-			int leftNodeIdx = nodesUsed++;
-			int rightNodeIdx = nodesUsed++;
+		//SAH guided tree rotations (Kensler 2008): a child is swapped with a grandchild on the other side when that shrinks
+		//the sibling receiving it. Bottom-up passes repeat until nothing improves or the time budget (ms) runs out.
+		void OptimizeBVH(float timeBudget)
+		{
+			const auto start{ std::chrono::steady_clock::now() };
+			const auto getElapsed{ [&start]()
+				{
+					return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+				} };
 
-			node.leftNode = leftNodeIdx;
-			pBVHNodes[leftNodeIdx].firstIdx = node.firstIdx;
-			pBVHNodes[leftNodeIdx].idxCount = leftCount;
-			pBVHNodes[rightNodeIdx].firstIdx = static_cast<unsigned int>(i);
-			pBVHNodes[rightNodeIdx].idxCount = node.idxCount - leftCount;
-			//Resetting idx count of this node to indicate it is not a leaf.
-			node.idxCount = 0;
+			bool isImproved{ true };
+			while (isImproved && getElapsed() < timeBudget)
+			{
+				unsigned int height{};
+				isImproved = RotateNodes(rootNodeIdx, 0, height);
+			}
+			bvhOptimizationTime = getElapsed();
+		}
 
-			//Update child nodes
-			UpdateNodeBounds(leftNodeIdx);
-			UpdateNodeBounds(rightNodeIdx);
+		//height receives an upper bound of the levels below nodeIdx after the rotations
+		bool RotateNodes(unsigned int nodeIdx, unsigned int depth, unsigned int& height)
+		{
+			const BVHNode& node{ bvhNodes[nodeIdx] };
+			if (node.IsLeaf())
+			{
+				height = 0;
+				return false;
+			}
 
-			Subdivide(leftNodeIdx);
-			Subdivide(rightNodeIdx);
+			const unsigned int leftNodeIdx{ node.leftFirst };
+			const unsigned int rightNodeIdx{ node.leftFirst + 1 };
+			unsigned int leftHeight{}, rightHeight{};
+			const bool isLeftImproved{ RotateNodes(leftNodeIdx, depth + 1, leftHeight) };
+			const bool isRightImproved{ RotateNodes(rightNodeIdx, depth + 1, rightHeight) };
+			const bool isRotated{ RotateChildren(leftNodeIdx, rightNodeIdx, depth, leftHeight, rightHeight) };
+			//The rotated child moves one level down, so the height grows by one at most
+			height = 1 + std::max(leftHeight, rightHeight) + isRotated;
+			return isLeftImproved || isRightImproved || isRotated;
 		}
 
-		float CalculateNodeCost(const BVHNode& node)
+		//Only the bounds of the sibling that receives the child change, so the gain is the area it loses.
+		//A child is only moved down if its subtree still ends above maxBVHDepth.
+		bool RotateChildren(unsigned int leftNodeIdx, unsigned int rightNodeIdx, unsigned int depth, unsigned int leftHeight, unsigned int rightHeight)
 		{
-			Vector3 extent { node.maxAABB - node.minAABB };
-			float area{ extent.x * extent.y + extent.y * extent.z + extent.z * extent.x };
-			return static_cast<float>(node.idxCount) * area;
+			float bestGain{};
+			unsigned int bestChildIdx{};
+			unsigned int bestGrandchildIdx{};
+			unsigned int bestSiblingIdx{};
+			const auto evaluate{ [&](unsigned int childIdx, unsigned int siblingIdx, unsigned int childHeight)
+				{
+					const BVHNode& sibling{ bvhNodes[siblingIdx] };
+					if (sibling.IsLeaf()) return;
+					if (depth + 2 + childHeight >= maxBVHDepth) return;
+
+					const BVHNode& child{ bvhNodes[childIdx] };
+					const float siblingArea{ GetNodeArea(sibling) };
+					for (unsigned int i{}; i < 2; ++i)
+					{
+						//The child takes the place of this grandchild, next to the other one
+						const BVHNode& remaining{ bvhNodes[sibling.leftFirst + 1 - i] };
+						BVHNode rotated{};
+						rotated.minAABB = Vector3::Min(child.minAABB, remaining.minAABB);
+						rotated.maxAABB = Vector3::Max(child.maxAABB, remaining.maxAABB);
+
+						//Ignore tiny gains so rounding can not make nodes swap back and forth
+						const float gain{ siblingArea - GetNodeArea(rotated) };
+						if (gain > bestGain && gain > siblingArea * 1e-5f)
+						{
+							bestGain = gain;
+							bestChildIdx = childIdx;
+							bestGrandchildIdx = sibling.leftFirst + i;
+							bestSiblingIdx = siblingIdx;
+						}
+					}
+				} };
+			evaluate(leftNodeIdx, rightNodeIdx, leftHeight);
+			evaluate(rightNodeIdx, leftNodeIdx, rightHeight);
+			if (bestGain <= 0.f) return false;
+
+			//Subtrees move along with their root node, only the sibling bounds need to be updated
+			std::swap(bvhNodes[bestChildIdx], bvhNodes[bestGrandchildIdx]);
+			UpdateNodeBoundsFromChildren(bestSiblingIdx);
+			return true;
 		}
 
-		float FindBestSplitPlane(BVHNode& node, int& axis, float& splitPos)
+		//Moves the nodes into the given order and patches the child indices, the root stays at index 0.
+		//Only the binary pool moves, the wide layouts and baked triangles do not depend on node indices.
+		//Access frequency needs the visits of every node, without them it falls back to van Emde Boas.
+		void ReorderBVHNodes(BVHNodeOrder order, const std::vector<unsigned int>& nodeVisits = {})
 		{
-			float bestCost{ FLT_MAX };
-			//Loop over all axes with x = 0, y = 1, z = 2, to determine the best split axis
-			for (int axisIdx{}; axisIdx < 3; ++axisIdx)
+			if (bvhNodes.empty() || order == BVHNodeOrder::Creation) return;
+
+			//Old indices of the nodes in their new order
+			std::vector<unsigned int> nodeOrder{};
+			nodeOrder.reserve(nodesUsed);
+			nodeOrder.push_back(rootNodeIdx);
+			if (order == BVHNodeOrder::AccessFrequency && nodeVisits.size() == nodesUsed)
 			{
-				float minBounds{ FLT_MAX };
-				float maxBounds{ FLT_MIN };
+				AppendByAccessFrequency(nodeVisits, nodeOrder);
+			}
+			else
+			{
+				AppendVanEmdeBoas(rootNodeIdx, GetSubtreeHeight(rootNodeIdx), nodeOrder);
+			}
+			assert(nodeOrder.size() == nodesUsed);
 
-				//Calculate bounding box for this node
-				for (unsigned int idx{}; idx < node.idxCount; idx += 3)
-				{
-					const unsigned int idxOffset{ node.firstIdx + idx };
-					Vector3 centroid{
-						(transformedPositions[indices[node.firstIdx + idx]] + 
-						transformedPositions[indices[idxOffset + 1]] + 
-							transformedPositions[indices[idxOffset + 2]]) * 0.3333f
-					};
+			std::vector<unsigned int> newNodeIndices(nodesUsed);
+			for (unsigned int i{}; i < nodesUsed; ++i)
+			{
+				newNodeIndices[nodeOrder[i]] = i;
+			}
 
-					minBounds = std::min(minBounds, centroid[axisIdx]);
-					maxBounds = std::max(maxBounds, centroid[axisIdx]);
+			std::vector<BVHNode> orderedNodes(nodesUsed);
+			for (unsigned int i{}; i < nodesUsed; ++i)
+			{
+				BVHNode& node{ orderedNodes[i] };
+				node = bvhNodes[nodeOrder[i]];
+				if (!node.IsLeaf())
+				{
+					node.leftFirst = newNodeIndices[node.leftFirst];
 				}
-				//Continue to next loop if bounds are equal
-				const float boundsDifference{ maxBounds - minBounds };
-				if (abs(boundsDifference) < FLT_EPSILON) continue;
+			}
+			bvhNodes.swap(orderedNodes);
+			rootNodeIdx = 0;
+		}
 
-				//Populate bins with positions
-				const int amountOfBins{ 8 };
-				Bin bins[amountOfBins];
-				float scale = amountOfBins / boundsDifference;
-				const int amountOfPlaneBins{ amountOfBins - 1 };
-				for (unsigned int idx{}; idx < node.idxCount; idx += 3)
-				{
-					const unsigned int idxOffset{ node.firstIdx + idx };
-					const Vector3& v0{ transformedPositions[indices[idxOffset]] };
-					const Vector3& v1{ transformedPositions[indices[idxOffset + 1]] };
-					const Vector3& v2{ transformedPositions[indices[idxOffset + 2]] };
-					const Vector3 centroid{ (v0 + v1 + v2) * 0.3333f };
+		//Lays out the nodes by the visits a profiling traversal counted per node of the current order
+		void ReorderBVHNodesByProfile(const std::vector<unsigned int>& nodeVisits)
+		{
+			bvhNodeOrder = BVHNodeOrder::AccessFrequency;
+			ReorderBVHNodes(bvhNodeOrder, nodeVisits);
+		}
 
-					const int binIdx{ std::min(amountOfPlaneBins, static_cast<int>((centroid[axisIdx] - minBounds) * scale)) };
-					bins[binIdx].idxCount += 3;
-					bins[binIdx].bounds.Grow(v0);
-					bins[binIdx].bounds.Grow(v1);
-					bins[binIdx].bounds.Grow(v2);
-				}
+		unsigned int GetSubtreeHeight(unsigned int nodeIdx) const
+		{
+			const BVHNode& node{ bvhNodes[nodeIdx] };
+			if (node.IsLeaf()) return 0;
+			return 1 + std::max(GetSubtreeHeight(node.leftFirst), GetSubtreeHeight(node.leftFirst + 1));
+		}
 
-				//Gather data for binAmount - 1 planes for binAmount planes
-				float leftArea[amountOfPlaneBins]{};
-				float rightArea[amountOfPlaneBins]{};
-				int leftCount[amountOfPlaneBins]{};
-				int rightCount[amountOfPlaneBins]{};
-				int leftSum{};
-				int rightSum{};
-				AABB leftBox;
-				AABB rightBox;
+		//Appends the sibling pairs of the given amount of levels below nodeIdx: the top half of the levels first,
+		//then every subtree hanging below it as its own block, recursively
+		void AppendVanEmdeBoas(unsigned int nodeIdx, unsigned int levels, std::vector<unsigned int>& nodeOrder) const
+		{
+			const BVHNode& node{ bvhNodes[nodeIdx] };
+			if (node.IsLeaf() || levels == 0) return;
 
-				for (int i{}; i < amountOfPlaneBins; ++i)
+			if (levels == 1)
+			{
+				nodeOrder.push_back(node.leftFirst);
+				nodeOrder.push_back(node.leftFirst + 1);
+				return;
+			}
+
+			const unsigned int topLevels{ levels / 2 };
+			AppendVanEmdeBoas(nodeIdx, topLevels, nodeOrder);
+
+			std::vector<unsigned int> bottomRoots{};
+			GatherNodesAtDepth(nodeIdx, topLevels, bottomRoots);
+			for (const unsigned int bottomRootIdx : bottomRoots)
+			{
+				AppendVanEmdeBoas(bottomRootIdx, levels - topLevels, nodeOrder);
+			}
+		}
+
+		void GatherNodesAtDepth(unsigned int nodeIdx, unsigned int depth, std::vector<unsigned int>& nodeIndices) const
+		{
+			const BVHNode& node{ bvhNodes[nodeIdx] };
+			if (depth == 0)
+			{
+				nodeIndices.push_back(nodeIdx);
+				return;
+			}
+			if (node.IsLeaf()) return;
+
+			GatherNodesAtDepth(node.leftFirst, depth - 1, nodeIndices);
+			GatherNodesAtDepth(node.leftFirst + 1, depth - 1, nodeIndices);
+		}
+
+		//Treelets of the most visited sibling pairs are laid out as contiguous blocks of bvhTreeletPairs pairs, the subtrees
+		//hanging below a treelet follow it depth first. Both children are fetched every time their parent is traversed,
+		//so the visits of the parent rank the pair; nodes the profile never reached are ranked by their surface area.
+		void AppendByAccessFrequency(const std::vector<unsigned int>& nodeVisits, std::vector<unsigned int>& nodeOrder) const
+		{
+			const auto isColder{ [this, &nodeVisits](unsigned int leftNodeIdx, unsigned int rightNodeIdx)
 				{
-					//Left side
-					leftSum += bins[i].idxCount;
-					leftCount[i] = leftSum;
-					leftBox.Grow(bins[i].bounds);
-					leftArea[i] = leftBox.Area();
+					if (nodeVisits[leftNodeIdx] != nodeVisits[rightNodeIdx])
+					{
+						return nodeVisits[leftNodeIdx] < nodeVisits[rightNodeIdx];
+					}
+					return GetNodeArea(bvhNodes[leftNodeIdx]) < GetNodeArea(bvhNodes[rightNodeIdx]);
+				} };
 
-					//Right side
-					rightSum += bins[amountOfPlaneBins - i].idxCount;
-					rightCount[amountOfPlaneBins - i - 1] = rightSum;
-					rightBox.Grow(bins[amountOfPlaneBins - i].bounds);
-					rightArea[amountOfPlaneBins - i - 1] = rightBox.Area();
-				}
+			std::vector<unsigned int> treeletRoots{ rootNodeIdx };
+			std::vector<unsigned int> frontier{};
+			while (!treeletRoots.empty())
+			{
+				const unsigned int treeletRootIdx{ treeletRoots.back() };
+				treeletRoots.pop_back();
+				if (bvhNodes[treeletRootIdx].IsLeaf()) continue;
 
-				//calculate SAH cost for the binAmount - 1 planes
-				scale = boundsDifference / amountOfBins;
-				for (int i{}; i < amountOfPlaneBins; ++i)
+				//Grow the treelet by the hottest pair below it until it is full
+				frontier.assign(1, treeletRootIdx);
+				for (unsigned int pairCount{}; pairCount < bvhTreeletPairs && !frontier.empty(); ++pairCount)
 				{
-					const float planeCost{ leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i] };
-					if (planeCost < bestCost)
+					std::pop_heap(frontier.begin(), frontier.end(), isColder);
+					const unsigned int leftNodeIdx{ bvhNodes[frontier.back()].leftFirst };
+					frontier.pop_back();
+
+					nodeOrder.push_back(leftNodeIdx);
+					nodeOrder.push_back(leftNodeIdx + 1);
+					for (const unsigned int childIdx : { leftNodeIdx, leftNodeIdx + 1 })
 					{
-						axis = axisIdx;
-						splitPos = minBounds + scale * (i + 1);
-						bestCost = planeCost;
+						if (bvhNodes[childIdx].IsLeaf()) continue;
+						frontier.push_back(childIdx);
+						std::push_heap(frontier.begin(), frontier.end(), isColder);
 					}
 				}
+
+				//The hottest remaining subtree is laid out first, right after this treelet
+				std::sort(frontier.begin(), frontier.end(), isColder);
+				treeletRoots.insert(treeletRoots.end(), frontier.begin(), frontier.end());
 			}
-			return bestCost;
 		}
 
-		//Unused
-		float EvalulateSAH(BVHNode& node, int axis, float pos)
+		void BakeTrianglePackets()
 		{
-			AABB leftBox{};
-			AABB rightBox{};
-			int leftCount{};
-			int rightCount{};
-			for (unsigned int idx{}; idx < node.idxCount; idx += 3)
+			trianglePackets.clear();
+			leafPacketIdx.assign(bakedTriangles.size(), 0);
+			for (unsigned int nodeIdx{}; nodeIdx < nodesUsed; ++nodeIdx)
 			{
-				const unsigned int idxOffset{ node.firstIdx + idx };
-				const Vector3& v0{ transformedPositions[indices[idxOffset]] };
-				const Vector3& v1{ transformedPositions[indices[idxOffset + 1]] };
-				const Vector3& v2{ transformedPositions[indices[idxOffset + 2]] };
-				const Vector3 centroid{ (v0 + v1 + v2) / 3.f };
+				const BVHNode& node{ bvhNodes[nodeIdx] };
+				if (!node.IsLeaf()) continue;
 
-				if (centroid[axis] > pos)
+				const unsigned int firstTriangle{ node.leftFirst / 3 };
+				const unsigned int triangleCount{ node.idxCount / 3 };
+				leafPacketIdx[firstTriangle] = static_cast<unsigned int>(trianglePackets.size());
+				for (unsigned int triangleIdx{}; triangleIdx < triangleCount; ++triangleIdx)
 				{
-					++leftCount;
-					leftBox.Grow(v0);
-					leftBox.Grow(v1);
-					leftBox.Grow(v2);
+					if (triangleIdx % TrianglePacket::width == 0)
+					{
+						trianglePackets.emplace_back();
+					}
+					trianglePackets.back().SetLane(triangleIdx % TrianglePacket::width, bakedTriangles[firstTriangle + triangleIdx]);
 				}
-				else
-				{
-					++rightCount;
-					rightBox.Grow(v0);
+			}
+		}
+
+		void BakeTriangles()
+		{
+			bakedTriangles.clear();
+			bakedTriangles.reserve(indices.size() / 3);
+			for (size_t idx{}; idx < indices.size(); idx += 3)
+			{
+				bakedTriangles.emplace_back(positions[indices[idx]], positions[indices[idx + 1]], positions[indices[idx + 2]], normals[idx / 3]);
+			}
+		}
+
+		//Memory of all node pools (binary + wide layouts) divided over the triangles
+		float GetBVHBytesPerTriangle(BVHLayout layout) const
+		{
+			const size_t triangleCount{ indices.size() / 3 };
+			if (triangleCount == 0) return 0.f;
+
+			size_t bytes{};
+			switch (layout)
+			{
+			case BVHLayout::Binary:
+				bytes = bvhNodes.capacity() * sizeof(BVHNode);
+				break;
+			case BVHLayout::Wide4:
+				bytes = bvh4Nodes.capacity() * sizeof(WideBVHNode<4>);
+				break;
+			case BVHLayout::Wide8:
+				bytes = bvh8Nodes.capacity() * sizeof(WideBVHNode<8>);
+				break;
+			default:
+				assert(false && "Unknown BVH layout");
+				break;
+			}
+			return static_cast<float>(bytes) / triangleCount;
+		}
+
+		template<int Width>
+		void CollapseBVH(std::vector<WideBVHNode<Width>>& wideNodes) const
+		{
+			wideNodes.clear();
+			wideNodes.reserve(nodesUsed);
+			wideNodes.emplace_back();
+			CollapseNode(wideNodes, 0, rootNodeIdx);
+			wideNodes.shrink_to_fit();
+		}
+
+		template<int Width>
+		void CollapseNode(std::vector<WideBVHNode<Width>>& wideNodes, unsigned int wideNodeIdx, unsigned int nodeIdx) const
+		{
+			//Gather the children by opening the inner child with the largest surface area until the node is full
+			unsigned int children[Width]{};
+			unsigned int childCount{};
+			const BVHNode& node{ bvhNodes[nodeIdx] };
+			if (node.IsLeaf())
+			{
+				children[childCount++] = nodeIdx;
+			}
+			else
+			{
+				children[childCount++] = node.leftFirst;
+				children[childCount++] = node.leftFirst + 1;
+			}
+
+			while (childCount < Width)
+			{
+				int bestChild{ -1 };
+				float bestArea{ -1.f };
+				for (unsigned int i{}; i < childCount; ++i)
+				{
+					const BVHNode& child{ bvhNodes[children[i]] };
+					if (child.IsLeaf()) continue;
+
+					const Vector3 extent{ child.maxAABB - child.minAABB };
+					const float area{ extent.x * extent.y + extent.y * extent.z + extent.z * extent.x };
+					if (area > bestArea)
+					{
+						bestArea = area;
+						bestChild = static_cast<int>(i);
+					}
+				}
+				if (bestChild < 0) break;
+
+				const unsigned int openedLeftNode{ bvhNodes[children[bestChild]].leftFirst };
+				children[bestChild] = openedLeftNode;
+				children[childCount++] = openedLeftNode + 1;
+			}
+
+			//Fill the slots, empty slots are never tested since childCount limits the hit mask
+			wideNodes[wideNodeIdx].childCount = childCount;
+			for (unsigned int i{}; i < Width; ++i)
+			{
+				const bool isUsed{ i < childCount };
+				const BVHNode& child{ bvhNodes[children[isUsed ? i : 0]] };
+				WideBVHNode<Width>& wideNode{ wideNodes[wideNodeIdx] };
+				wideNode.minX[i] = isUsed ? child.minAABB.x : FLT_MAX;
+				wideNode.minY[i] = isUsed ? child.minAABB.y : FLT_MAX;
+				wideNode.minZ[i] = isUsed ? child.minAABB.z : FLT_MAX;
+				wideNode.maxX[i] = isUsed ? child.maxAABB.x : -FLT_MAX;
+				wideNode.maxY[i] = isUsed ? child.maxAABB.y : -FLT_MAX;
+				wideNode.maxZ[i] = isUsed ? child.maxAABB.z : -FLT_MAX;
+				wideNode.idxCount[i] = isUsed ? child.idxCount : 0;
+				wideNode.child[i] = child.leftFirst;
+				if (!isUsed || child.IsLeaf()) continue;
+
+				//Inner child: collapse it into a new wide node (this can reallocate, so no references are kept)
+				const unsigned int childWideNodeIdx{ static_cast<unsigned int>(wideNodes.size()) };
+				wideNodes.emplace_back();
+				wideNodes[wideNodeIdx].child[i] = childWideNodeIdx;
+				CollapseNode(wideNodes, childWideNodeIdx, children[i]);
+			}
+		}
+
+		void CalculateBuildData(unsigned int threadCount)
+		{
+			const unsigned int triangleCount{ static_cast<unsigned int>(indices.size() / 3) };
+			buildCentroids.resize(triangleCount);
+			buildBounds.resize(triangleCount);
+			ParallelChunks(triangleCount, threadCount, [this](unsigned int, unsigned int first, unsigned int last)
+				{
+					for (unsigned int triangleIdx{ first }; triangleIdx < last; ++triangleIdx)
+					{
+						const Vector3& v0{ positions[indices[triangleIdx * 3]] };
+						const Vector3& v1{ positions[indices[triangleIdx * 3 + 1]] };
+						const Vector3& v2{ positions[indices[triangleIdx * 3 + 2]] };
+						buildCentroids[triangleIdx] = (v0 + v1 + v2) * 0.3333f;
+
+						AABB& bounds{ buildBounds[triangleIdx] };
+						bounds = AABB{};
+						bounds.Grow(v0);
+						bounds.Grow(v1);
+						bounds.Grow(v2);
+					}
+				});
+		}
+
+		void CalculateMortonCodes(unsigned int threadCount)
+		{
+			const unsigned int triangleCount{ static_cast<unsigned int>(buildCentroids.size()) };
+			AABB centroidBounds{};
+			for (const Vector3& centroid : buildCentroids)
+			{
+				centroidBounds.Grow(centroid);
+			}
+
+			//Quantize the centroids inside their bounds, flat axes all map to 0
+			const Vector3 extent{ centroidBounds.maxAABB - centroidBounds.minAABB };
+			const Vector3 scale{
+				extent.x > FLT_EPSILON ? 1.f / extent.x : 0.f,
+				extent.y > FLT_EPSILON ? 1.f / extent.y : 0.f,
+				extent.z > FLT_EPSILON ? 1.f / extent.z : 0.f };
+
+			buildMortonCodes.resize(triangleCount);
+			ParallelChunks(triangleCount, threadCount, [&](unsigned int, unsigned int first, unsigned int last)
+				{
+					for (unsigned int triangleIdx{ first }; triangleIdx < last; ++triangleIdx)
+					{
+						const Vector3 offset{ buildCentroids[triangleIdx] - centroidBounds.minAABB };
+						buildMortonCodes[triangleIdx] = MortonCode({ offset.x * scale.x, offset.y * scale.y, offset.z * scale.z });
+					}
+				});
+		}
+
+		unsigned int GetChunkCount(const BVHNode& node, unsigned int threadCount) const
+		{
+			return node.idxCount / 3 >= parallelBinThreshold ? threadCount : 1;
+		}
+
+		//Builds both subtrees, concurrently when both are large enough, the thread budget is split between them
+		template<typename BuildFunction>
+		void BuildChildren(unsigned int leftNodeIdx, unsigned int rightNodeIdx, unsigned int threadCount, const BuildFunction& build)
+		{
+			if (threadCount > 1 && bvhNodes[leftNodeIdx].idxCount / 3 >= parallelSubtreeThreshold &&
+				bvhNodes[rightNodeIdx].idxCount / 3 >= parallelSubtreeThreshold)
+			{
+				//Both subtrees are tasks on the build pool, the loops inside them nest on the same threads
+				const unsigned int leftThreadCount{ threadCount / 2 };
+				GetBuildThreadPool().ParallelFor(2, 1, [&build, leftNodeIdx, rightNodeIdx, threadCount, leftThreadCount](uint32_t childIdx)
+					{
+						if (childIdx == 0) build(leftNodeIdx, leftThreadCount);
+						else build(rightNodeIdx, threadCount - leftThreadCount);
+					});
+				return;
+			}
+
+			build(leftNodeIdx, threadCount);
+			build(rightNodeIdx, threadCount);
+		}
+
+		void UpdateNodeBounds(unsigned int nodeIdx, unsigned int threadCount = 1)
+		{
+			BVHNode& node{ bvhNodes[nodeIdx] };
+			const unsigned int firstTriangle{ node.leftFirst / 3 };
+			const unsigned int chunkCount{ GetChunkCount(node, threadCount) };
+
+			std::vector<AABB> chunkBounds(chunkCount);
+			ParallelChunks(node.idxCount / 3, chunkCount, [&](unsigned int chunkIdx, unsigned int first, unsigned int last)
+				{
+					for (unsigned int triangleIdx{ firstTriangle + first }; triangleIdx < firstTriangle + last; ++triangleIdx)
+					{
+						chunkBounds[chunkIdx].Grow(buildBounds[triangleIdx]);
+					}
+				});
+
+			//Reset bounding box of the node
+			AABB bounds{};
+			for (const AABB& chunk : chunkBounds)
+			{
+				bounds.Grow(chunk);
+			}
+			node.minAABB = bounds.minAABB;
+			node.maxAABB = bounds.maxAABB;
+		}
+
+		void Subdivide(unsigned int nodeIdx, std::atomic<unsigned int>& nodeCounter, unsigned int threadCount, unsigned int depth = 0)
+		{
+			//Terminate Recursion if necessary
+			BVHNode& node = bvhNodes[nodeIdx];
+			if (node.idxCount <= 3 * leafSize || depth + 1 >= maxBVHDepth) return;
+
+			//Below the SAH levels the linear builder takes over the whole subtree
+			if (bvhBuilder == BVHBuilder::LBVH && depth >= lbvhSAHLevels)
+			{
+				SortByMortonCode(node.leftFirst / 3, node.idxCount / 3, threadCount);
+				EmitLBVH(nodeIdx, nodeCounter, threadCount, depth);
+				return;
+			}
+
+			//Determine split axis
+#ifdef USE_BINS
+			int axis{ 0 };
+			float splitPos{};
+			const float splitCost{ FindBestSplitPlane(node, axis, splitPos, threadCount) };
+			const float noSplitCost{ CalculateNodeCost(node) };
+			if (splitCost >= noSplitCost) return;
+#else
+			Vector3 extent{ node.maxAABB - node.minAABB };
+			int axis{ 0 };
+			if (extent.y > extent.x) axis = 1;
+			if (extent.z > extent[axis]) axis = 2;
+			float splitPos{ node.minAABB[axis] + extent[axis] * 0.5f };
+#endif
+			//Partitioning
+			int i{ static_cast<int>(node.leftFirst) };
+			int j{ i + static_cast<int>(node.idxCount) - 1 };
+			while (i <= j)
+			{
+				if (buildCentroids[i / 3][axis] < splitPos)
+				{
+					i += 3;
+				}
+				else
+				{
+					std::swap(normals[i / 3], normals[(j - 2) / 3]);
+					std::swap(buildCentroids[i / 3], buildCentroids[(j - 2) / 3]);
+					std::swap(buildBounds[i / 3], buildBounds[(j - 2) / 3]);
+					if (!buildMortonCodes.empty())
+					{
+						std::swap(buildMortonCodes[i / 3], buildMortonCodes[(j - 2) / 3]);
+					}
+
+					std::swap(indices[i], indices[j - 2]);
+					std::swap(indices[i + 1], indices[j - 1]);
+					std::swap(indices[i + 2], indices[j]);
+					j -= 3;
+				}
+			}
+
+			int leftCount{ i - static_cast<int>(node.leftFirst) };
+			if (leftCount == 0 || leftCount == node.idxCount)
+			{
+				return;
+			}
+
+			//Setting Data, both children are allocated together so they stay adjacent
+			const unsigned int leftNodeIdx{ nodeCounter.fetch_add(2) };
+			const unsigned int rightNodeIdx{ leftNodeIdx + 1 };
+
+			bvhNodes[leftNodeIdx].leftFirst = node.leftFirst;
+			bvhNodes[leftNodeIdx].idxCount = leftCount;
+			bvhNodes[rightNodeIdx].leftFirst = static_cast<unsigned int>(i);
+			bvhNodes[rightNodeIdx].idxCount = node.idxCount - leftCount;
+			node.leftFirst = leftNodeIdx;
+			//Resetting idx count of this node to indicate it is not a leaf.
+			node.idxCount = 0;
+
+			//Update child nodes
+			UpdateNodeBounds(leftNodeIdx, threadCount);
+			UpdateNodeBounds(rightNodeIdx, threadCount);
+
+			BuildChildren(leftNodeIdx, rightNodeIdx, threadCount, [this, &nodeCounter, depth](unsigned int childIdx, unsigned int childThreadCount)
+				{
+					Subdivide(childIdx, nodeCounter, childThreadCount, depth + 1);
+				});
+		}
+
+		//Spatial split BVH (Stich et al. 2009): besides object splits, nodes can be split by a plane that clips the
+		//triangles crossing it, duplicating their references. Runs on a single thread.
+		void BuildSpatialBVH()
+		{
+			const unsigned int triangleCount{ static_cast<unsigned int>(indices.size() / 3) };
+			const unsigned int maxReferenceCount{ triangleCount + static_cast<unsigned int>(triangleCount * spatialSplitBudget) };
+			bvhNodes.resize(2 * maxReferenceCount - 1);
+
+			std::vector<BVHReference> references(triangleCount);
+			AABB rootBounds{};
+			for (unsigned int triangleIdx{}; triangleIdx < triangleCount; ++triangleIdx)
+			{
+				BVHReference& reference{ references[triangleIdx] };
+				reference.triangleIdx = triangleIdx;
+				reference.bounds.Grow(positions[indices[triangleIdx * 3]]);
+				reference.bounds.Grow(positions[indices[triangleIdx * 3 + 1]]);
+				reference.bounds.Grow(positions[indices[triangleIdx * 3 + 2]]);
+				rootBounds.Grow(reference.bounds);
+			}
+
+			std::vector<unsigned int> leafReferences{};
+			leafReferences.reserve(maxReferenceCount);
+			unsigned int referenceCount{ triangleCount };
+			nodesUsed = 1;
+			SubdivideSpatial(rootNodeIdx, references, rootBounds.Area(), leafReferences, referenceCount, maxReferenceCount);
+
+			//Every reference gets its own copy of the triangle indices, so leaves stay contiguous ranges
+			std::vector<int> referenceIndices{};
+			std::vector<Vector3> referenceNormals{};
+			referenceIndices.reserve(leafReferences.size() * 3);
+			referenceNormals.reserve(leafReferences.size());
+			for (const unsigned int triangleIdx : leafReferences)
+			{
+				referenceIndices.push_back(indices[triangleIdx * 3]);
+				referenceIndices.push_back(indices[triangleIdx * 3 + 1]);
+				referenceIndices.push_back(indices[triangleIdx * 3 + 2]);
+				referenceNormals.push_back(normals[triangleIdx]);
+			}
+			indices = std::move(referenceIndices);
+			normals = std::move(referenceNormals);
+
+			referenceTriangles.clear();
+			if (leafReferences.size() > triangleCount)
+			{
+				referenceTriangles = std::move(leafReferences);
+			}
+		}
+
+		void RemoveDuplicateReferences()
+		{
+			if (referenceTriangles.empty()) return;
+
+			const unsigned int triangleCount{ *std::max_element(referenceTriangles.begin(), referenceTriangles.end()) + 1 };
+			std::vector<int> uniqueIndices(triangleCount * 3);
+			std::vector<Vector3> uniqueNormals(triangleCount);
+			for (size_t referenceIdx{}; referenceIdx < referenceTriangles.size(); ++referenceIdx)
+			{
+				const unsigned int triangleIdx{ referenceTriangles[referenceIdx] };
+				uniqueIndices[triangleIdx * 3] = indices[referenceIdx * 3];
+				uniqueIndices[triangleIdx * 3 + 1] = indices[referenceIdx * 3 + 1];
+				uniqueIndices[triangleIdx * 3 + 2] = indices[referenceIdx * 3 + 2];
+				uniqueNormals[triangleIdx] = normals[referenceIdx];
+			}
+			indices = std::move(uniqueIndices);
+			normals = std::move(uniqueNormals);
+			referenceTriangles.clear();
+		}
+
+		void SubdivideSpatial(unsigned int nodeIdx, std::vector<BVHReference>& references, float rootArea,
+			std::vector<unsigned int>& leafReferences, unsigned int& referenceCount, unsigned int maxReferenceCount, unsigned int depth = 0)
+		{
+			BVHNode& node = bvhNodes[nodeIdx];
+			AABB nodeBounds{};
+			for (const BVHReference& reference : references)
+			{
+				nodeBounds.Grow(reference.bounds);
+			}
+			node.minAABB = nodeBounds.minAABB;
+			node.maxAABB = nodeBounds.maxAABB;
+
+			const unsigned int count{ static_cast<unsigned int>(references.size()) };
+			std::vector<BVHReference> leftReferences{};
+			std::vector<BVHReference> rightReferences{};
+
+			//Terminate Recursion if necessary
+			bool isLeaf{ count <= leafSize || depth + 1 >= maxBVHDepth };
+			if (!isLeaf && depth >= maxSpatialDepth)
+			{
+				//Large overlapping triangles can peel off a few references per level, split by count to bound the depth
+				SplitReferencesMedian(references, nodeBounds, leftReferences, rightReferences);
+			}
+			else if (!isLeaf)
+			{
+				isLeaf = !SplitReferences(references, nodeBounds, rootArea, referenceCount, maxReferenceCount, leftReferences, rightReferences);
+			}
+
+			if (isLeaf || leftReferences.empty() || rightReferences.empty())
+			{
+				node.leftFirst = static_cast<unsigned int>(leafReferences.size()) * 3;
+				node.idxCount = count * 3;
+				for (const BVHReference& reference : references)
+				{
+					leafReferences.push_back(reference.triangleIdx);
+				}
+				return;
+			}
+			referenceCount += static_cast<unsigned int>(leftReferences.size() + rightReferences.size()) - count;
+
+			//The references of this node are no longer needed while the children are built
+			std::vector<BVHReference>().swap(references);
+
+			//Setting Data
+			const unsigned int leftNodeIdx{ nodesUsed };
+			nodesUsed += 2;
+			node.leftFirst = leftNodeIdx;
+			//Resetting idx count of this node to indicate it is not a leaf.
+			node.idxCount = 0;
+
+			SubdivideSpatial(leftNodeIdx, leftReferences, rootArea, leafReferences, referenceCount, maxReferenceCount, depth + 1);
+			SubdivideSpatial(leftNodeIdx + 1, rightReferences, rootArea, leafReferences, referenceCount, maxReferenceCount, depth + 1);
+		}
+
+		//Picks the cheapest of the object and spatial split and partitions the references, returns false when a leaf is cheaper
+		bool SplitReferences(const std::vector<BVHReference>& references, const AABB& nodeBounds, float rootArea, unsigned int referenceCount,
+			unsigned int maxReferenceCount, std::vector<BVHReference>& leftReferences, std::vector<BVHReference>& rightReferences) const
+		{
+			const BVHSplit objectSplit{ FindObjectSplit(references) };
+
+			//Only look for a spatial split if the object split children overlap enough to matter
+			BVHSplit spatialSplit{};
+			AABB overlap{ objectSplit.leftBounds };
+			overlap.minAABB = Vector3::Max(overlap.minAABB, objectSplit.rightBounds.minAABB);
+			overlap.maxAABB = Vector3::Min(overlap.maxAABB, objectSplit.rightBounds.maxAABB);
+			const bool hasOverlap{ overlap.minAABB.x <= overlap.maxAABB.x && overlap.minAABB.y <= overlap.maxAABB.y && overlap.minAABB.z <= overlap.maxAABB.z };
+			if (hasOverlap && overlap.Area() > spatialSplitOverlap * rootArea)
+			{
+				spatialSplit = FindSpatialSplit(references, nodeBounds, maxReferenceCount - referenceCount);
+			}
+
+			//The binned estimate of the duplicates can be off near the plane, recheck against the budget
+			bool useSpatialSplit{ spatialSplit.cost < objectSplit.cost };
+			if (useSpatialSplit)
+			{
+				unsigned int duplicateCount{};
+				for (const BVHReference& reference : references)
+				{
+					if (reference.bounds.minAABB[spatialSplit.axis] < spatialSplit.position && reference.bounds.maxAABB[spatialSplit.axis] > spatialSplit.position)
+					{
+						++duplicateCount;
+					}
+				}
+				useSpatialSplit = referenceCount + duplicateCount <= maxReferenceCount;
+			}
+
+			AABB bounds{ nodeBounds };
+			const float noSplitCost{ static_cast<float>(references.size()) * bounds.Area() };
+			//Splitting also costs the traversal of one more node
+			if ((useSpatialSplit ? spatialSplit.cost : objectSplit.cost) + bounds.Area() >= noSplitCost) return false;
+
+			//Partitioning
+			if (useSpatialSplit)
+			{
+				const int axis{ spatialSplit.axis };
+				const float splitPos{ spatialSplit.position };
+				for (const BVHReference& reference : references)
+				{
+					if (reference.bounds.maxAABB[axis] <= splitPos)
+					{
+						leftReferences.push_back(reference);
+					}
+					else if (reference.bounds.minAABB[axis] >= splitPos)
+					{
+						rightReferences.push_back(reference);
+					}
+					else
+					{
+						//Straddling the plane, both sides get the clipped part
+						const Vector3& v0{ positions[indices[reference.triangleIdx * 3]] };
+						const Vector3& v1{ positions[indices[reference.triangleIdx * 3 + 1]] };
+						const Vector3& v2{ positions[indices[reference.triangleIdx * 3 + 2]] };
+						leftReferences.push_back({ ClipTriangleBounds(v0, v1, v2, axis, -FLT_MAX, splitPos, reference.bounds), reference.triangleIdx });
+						rightReferences.push_back({ ClipTriangleBounds(v0, v1, v2, axis, splitPos, FLT_MAX, reference.bounds), reference.triangleIdx });
+					}
+				}
+				return true;
+			}
+
+			for (const BVHReference& reference : references)
+			{
+				const float centroid{ (reference.bounds.minAABB[objectSplit.axis] + reference.bounds.maxAABB[objectSplit.axis]) * 0.5f };
+				if (centroid < objectSplit.position)
+				{
+					leftReferences.push_back(reference);
+				}
+				else
+				{
+					rightReferences.push_back(reference);
+				}
+			}
+			return true;
+		}
+
+		//Splits the references in two halves along the largest axis of the node
+		static void SplitReferencesMedian(std::vector<BVHReference>& references, const AABB& nodeBounds,
+			std::vector<BVHReference>& leftReferences, std::vector<BVHReference>& rightReferences)
+		{
+			const Vector3 extent{ nodeBounds.maxAABB - nodeBounds.minAABB };
+			int axis{ 0 };
+			if (extent.y > extent.x) axis = 1;
+			if (extent.z > extent[axis]) axis = 2;
+
+			const auto middle{ references.begin() + references.size() / 2 };
+			std::nth_element(references.begin(), middle, references.end(), [axis](const BVHReference& a, const BVHReference& b)
+				{
+					return a.bounds.minAABB[axis] + a.bounds.maxAABB[axis] < b.bounds.minAABB[axis] + b.bounds.maxAABB[axis];
+				});
+			leftReferences.assign(references.begin(), middle);
+			rightReferences.assign(middle, references.end());
+		}
+
+		//Binned SAH object split over the centroids of the reference bounds
+		BVHSplit FindObjectSplit(const std::vector<BVHReference>& references) const
+		{
+			const int amountOfBins{ 16 };
+			const int amountOfPlaneBins{ amountOfBins - 1 };
+			BVHSplit bestSplit{};
+
+			AABB centroidBounds{};
+			for (const BVHReference& reference : references)
+			{
+				centroidBounds.Grow((reference.bounds.minAABB + reference.bounds.maxAABB) * 0.5f);
+			}
+
+			for (int axisIdx{}; axisIdx < 3; ++axisIdx)
+			{
+				const float minBounds{ centroidBounds.minAABB[axisIdx] };
+				const float boundsDifference{ centroidBounds.maxAABB[axisIdx] - minBounds };
+				if (abs(boundsDifference) < FLT_EPSILON) continue;
+
+				Bin bins[amountOfBins];
+				const float scale{ amountOfBins / boundsDifference };
+				for (const BVHReference& reference : references)
+				{
+					const float centroid{ (reference.bounds.minAABB[axisIdx] + reference.bounds.maxAABB[axisIdx]) * 0.5f };
+					const int binIdx{ std::min(amountOfPlaneBins, static_cast<int>((centroid - minBounds) * scale)) };
+					++bins[binIdx].idxCount;
+					bins[binIdx].bounds.Grow(reference.bounds);
+				}
+
+				EvaluateBinnedSplits(bins, bins, amountOfBins, axisIdx, minBounds, boundsDifference / amountOfBins, bestSplit);
+			}
+			return bestSplit;
+		}
+
+		//Binned spatial split: every reference is clipped into all bins it overlaps, entering and leaving bins are counted
+		BVHSplit FindSpatialSplit(const std::vector<BVHReference>& references, const AABB& nodeBounds, unsigned int duplicateBudget) const
+		{
+			const int amountOfBins{ 16 };
+			const int amountOfPlaneBins{ amountOfBins - 1 };
+			BVHSplit bestSplit{};
+
+			for (int axisIdx{}; axisIdx < 3; ++axisIdx)
+			{
+				const float minBounds{ nodeBounds.minAABB[axisIdx] };
+				const float boundsDifference{ nodeBounds.maxAABB[axisIdx] - minBounds };
+				if (abs(boundsDifference) < FLT_EPSILON) continue;
+
+				//Entering references are counted in the bounds bin, leaving ones in the count bin
+				Bin bins[amountOfBins];
+				Bin exits[amountOfBins];
+				const float binWidth{ boundsDifference / amountOfBins };
+				const float scale{ amountOfBins / boundsDifference };
+				for (const BVHReference& reference : references)
+				{
+					const int firstBin{ std::clamp(static_cast<int>((reference.bounds.minAABB[axisIdx] - minBounds) * scale), 0, amountOfPlaneBins) };
+					const int lastBin{ std::clamp(static_cast<int>((reference.bounds.maxAABB[axisIdx] - minBounds) * scale), firstBin, amountOfPlaneBins) };
+					++bins[firstBin].idxCount;
+					++exits[lastBin].idxCount;
+
+					const Vector3& v0{ positions[indices[reference.triangleIdx * 3]] };
+					const Vector3& v1{ positions[indices[reference.triangleIdx * 3 + 1]] };
+					const Vector3& v2{ positions[indices[reference.triangleIdx * 3 + 2]] };
+					for (int binIdx{ firstBin }; binIdx <= lastBin; ++binIdx)
+					{
+						const float binMin{ minBounds + binWidth * binIdx };
+						bins[binIdx].bounds.Grow(ClipTriangleBounds(v0, v1, v2, axisIdx, binMin, binMin + binWidth, reference.bounds));
+					}
+				}
+
+				EvaluateBinnedSplits(bins, exits, amountOfBins, axisIdx, minBounds, binWidth, bestSplit, static_cast<unsigned int>(references.size()), duplicateBudget);
+			}
+			return bestSplit;
+		}
+
+		//Sweeps the planes between the bins, the left side counts the entering references and the right side the leaving ones.
+		//With a reference count, planes that would duplicate more references than the budget allows are skipped.
+		static void EvaluateBinnedSplits(const Bin* pBins, const Bin* pExits, int amountOfBins, int axis, float minBounds, float binWidth,
+			BVHSplit& bestSplit, unsigned int referenceCount = 0, unsigned int duplicateBudget = 0)
+		{
+			const int amountOfPlaneBins{ amountOfBins - 1 };
+			std::vector<AABB> rightBoxes(amountOfPlaneBins);
+			std::vector<unsigned int> rightCounts(amountOfPlaneBins);
+			AABB rightBox{};
+			unsigned int rightSum{};
+			for (int i{ amountOfPlaneBins }; i > 0; --i)
+			{
+				rightSum += pExits[i].idxCount;
+				rightBox.Grow(pBins[i].bounds);
+				rightCounts[i - 1] = rightSum;
+				rightBoxes[i - 1] = rightBox;
+			}
+
+			AABB leftBox{};
+			unsigned int leftSum{};
+			for (int i{}; i < amountOfPlaneBins; ++i)
+			{
+				leftSum += pBins[i].idxCount;
+				leftBox.Grow(pBins[i].bounds);
+				if (leftSum == 0 || rightCounts[i] == 0) continue;
+				if (referenceCount > 0 && leftSum + rightCounts[i] - referenceCount > duplicateBudget) continue;
+
+				const float planeCost{ leftSum * leftBox.Area() + rightCounts[i] * rightBoxes[i].Area() };
+				if (planeCost < bestSplit.cost)
+				{
+					bestSplit.cost = planeCost;
+					bestSplit.axis = axis;
+					bestSplit.position = minBounds + binWidth * (i + 1);
+					bestSplit.leftBounds = leftBox;
+					bestSplit.rightBounds = rightBoxes[i];
+				}
+			}
+		}
+
+		//Least significant digit radix sort of a triangle range on its Morton codes, 3 passes of 10 bits.
+		//Every chunk histograms and scatters its own part, so the sort stays stable with multiple threads.
+		void SortByMortonCode(unsigned int firstTriangle, unsigned int triangleCount, unsigned int threadCount)
+		{
+			const unsigned int radixBits{ 10 };
+			const unsigned int bucketCount{ 1u << radixBits };
+			const unsigned int chunkCount{ std::min(triangleCount >= parallelBinThreshold ? threadCount : 1, triangleCount) };
+
+			std::vector<unsigned int> order(triangleCount);
+			std::vector<unsigned int> sortedOrder(triangleCount);
+			std::iota(order.begin(), order.end(), firstTriangle);
+			std::vector<unsigned int> bucketOffsets(chunkCount * bucketCount);
+			for (unsigned int shift{}; shift < 3 * radixBits; shift += radixBits)
+			{
+				std::fill(bucketOffsets.begin(), bucketOffsets.end(), 0);
+				ParallelChunks(triangleCount, chunkCount, [&](unsigned int chunkIdx, unsigned int first, unsigned int last)
+					{
+						unsigned int* pOffsets{ &bucketOffsets[chunkIdx * bucketCount] };
+						for (unsigned int i{ first }; i < last; ++i)
+						{
+							++pOffsets[(buildMortonCodes[order[i]] >> shift) & (bucketCount - 1)];
+						}
+					});
+
+				//Exclusive prefix sum, bucket major so lower chunks come first within a bucket
+				unsigned int sum{};
+				for (unsigned int bucket{}; bucket < bucketCount; ++bucket)
+				{
+					for (unsigned int chunkIdx{}; chunkIdx < chunkCount; ++chunkIdx)
+					{
+						const unsigned int count{ bucketOffsets[chunkIdx * bucketCount + bucket] };
+						bucketOffsets[chunkIdx * bucketCount + bucket] = sum;
+						sum += count;
+					}
+				}
+
+				ParallelChunks(triangleCount, chunkCount, [&](unsigned int chunkIdx, unsigned int first, unsigned int last)
+					{
+						unsigned int* pOffsets{ &bucketOffsets[chunkIdx * bucketCount] };
+						for (unsigned int i{ first }; i < last; ++i)
+						{
+							sortedOrder[pOffsets[(buildMortonCodes[order[i]] >> shift) & (bucketCount - 1)]++] = order[i];
+						}
+					});
+				std::swap(order, sortedOrder);
+			}
+
+			//Apply the sorted order to the triangle data
+			const std::vector<int> oldIndices(indices.begin() + firstTriangle * 3, indices.begin() + (firstTriangle + triangleCount) * 3);
+			const std::vector<Vector3> oldNormals(normals.begin() + firstTriangle, normals.begin() + firstTriangle + triangleCount);
+			const std::vector<Vector3> oldCentroids(buildCentroids.begin() + firstTriangle, buildCentroids.begin() + firstTriangle + triangleCount);
+			const std::vector<AABB> oldBounds(buildBounds.begin() + firstTriangle, buildBounds.begin() + firstTriangle + triangleCount);
+			const std::vector<unsigned int> oldCodes(buildMortonCodes.begin() + firstTriangle, buildMortonCodes.begin() + firstTriangle + triangleCount);
+			ParallelChunks(triangleCount, chunkCount, [&](unsigned int, unsigned int first, unsigned int last)
+				{
+					for (unsigned int i{ first }; i < last; ++i)
+					{
+						const unsigned int oldIdx{ order[i] - firstTriangle };
+						const unsigned int newIdx{ firstTriangle + i };
+						indices[newIdx * 3] = oldIndices[oldIdx * 3];
+						indices[newIdx * 3 + 1] = oldIndices[oldIdx * 3 + 1];
+						indices[newIdx * 3 + 2] = oldIndices[oldIdx * 3 + 2];
+						normals[newIdx] = oldNormals[oldIdx];
+						buildCentroids[newIdx] = oldCentroids[oldIdx];
+						buildBounds[newIdx] = oldBounds[oldIdx];
+						buildMortonCodes[newIdx] = oldCodes[oldIdx];
+					}
+				});
+		}
+
+		//Splits a sorted range where the highest differing Morton bit changes, returns the first triangle of the right half
+		unsigned int FindMortonSplit(unsigned int firstTriangle, unsigned int lastTriangle) const
+		{
+			const unsigned int firstCode{ buildMortonCodes[firstTriangle] };
+			const unsigned int lastCode{ buildMortonCodes[lastTriangle - 1] };
+			//Identical codes, split in the middle
+			if (firstCode == lastCode) return (firstTriangle + lastTriangle) / 2;
+
+			//Binary search for the last code that shares more leading bits with the first code than the whole range does
+			const int commonPrefix{ std::countl_zero(firstCode ^ lastCode) };
+			unsigned int split{ firstTriangle };
+			unsigned int step{ lastTriangle - 1 - firstTriangle };
+			do
+			{
+				step = (step + 1) / 2;
+				const unsigned int newSplit{ split + step };
+				if (newSplit < lastTriangle - 1 && std::countl_zero(firstCode ^ buildMortonCodes[newSplit]) > commonPrefix)
+				{
+					split = newSplit;
+				}
+			} while (step > 1);
+
+			return split + 1;
+		}
+
+		//Emits the hierarchy of a Morton sorted range top-down, node bounds are gathered bottom-up
+		void EmitLBVH(unsigned int nodeIdx, std::atomic<unsigned int>& nodeCounter, unsigned int threadCount, unsigned int depth)
+		{
+			BVHNode& node = bvhNodes[nodeIdx];
+			if (node.idxCount <= 3 * leafSize || depth + 1 >= maxBVHDepth)
+			{
+				UpdateNodeBounds(nodeIdx);
+				return;
+			}
+
+			const unsigned int firstTriangle{ node.leftFirst / 3 };
+			const unsigned int lastTriangle{ firstTriangle + node.idxCount / 3 };
+			const unsigned int splitTriangle{ FindMortonSplit(firstTriangle, lastTriangle) };
+
+			const unsigned int leftNodeIdx{ nodeCounter.fetch_add(2) };
+			const unsigned int rightNodeIdx{ leftNodeIdx + 1 };
+			bvhNodes[leftNodeIdx].leftFirst = node.leftFirst;
+			bvhNodes[leftNodeIdx].idxCount = (splitTriangle - firstTriangle) * 3;
+			bvhNodes[rightNodeIdx].leftFirst = splitTriangle * 3;
+			bvhNodes[rightNodeIdx].idxCount = (lastTriangle - splitTriangle) * 3;
+			node.leftFirst = leftNodeIdx;
+			node.idxCount = 0;
+
+			BuildChildren(leftNodeIdx, rightNodeIdx, threadCount, [this, &nodeCounter, depth](unsigned int childIdx, unsigned int childThreadCount)
+				{
+					EmitLBVH(childIdx, nodeCounter, childThreadCount, depth + 1);
+				});
+
+			UpdateNodeBoundsFromChildren(nodeIdx);
+		}
+
+		float CalculateNodeCost(const BVHNode& node)
+		{
+			Vector3 extent { node.maxAABB - node.minAABB };
+			float area{ extent.x * extent.y + extent.y * extent.z + extent.z * extent.x };
+			return static_cast<float>(node.idxCount) * area;
+		}
+
+		float FindBestSplitPlane(const BVHNode& node, int& axis, float& splitPos, unsigned int threadCount = 1)
+		{
+			const int amountOfBins{ 8 };
+			const int amountOfPlaneBins{ amountOfBins - 1 };
+			const unsigned int firstTriangle{ node.leftFirst / 3 };
+			const unsigned int triangleCount{ node.idxCount / 3 };
+			const unsigned int chunkCount{ GetChunkCount(node, threadCount) };
+
+			//Centroid bounds for all axes in a single pass
+			std::vector<AABB> chunkCentroidBounds(chunkCount);
+			ParallelChunks(triangleCount, chunkCount, [&](unsigned int chunkIdx, unsigned int first, unsigned int last)
+				{
+					for (unsigned int triangleIdx{ firstTriangle + first }; triangleIdx < firstTriangle + last; ++triangleIdx)
+					{
+						chunkCentroidBounds[chunkIdx].Grow(buildCentroids[triangleIdx]);
+					}
+				});
+			AABB centroidBounds{};
+			for (const AABB& chunk : chunkCentroidBounds)
+			{
+				centroidBounds.Grow(chunk);
+			}
+
+			//Continue to next axis if bounds are equal
+			bool isAxisUsed[3]{};
+			float scale[3]{};
+			for (int axisIdx{}; axisIdx < 3; ++axisIdx)
+			{
+				const float boundsDifference{ centroidBounds.maxAABB[axisIdx] - centroidBounds.minAABB[axisIdx] };
+				isAxisUsed[axisIdx] = abs(boundsDifference) >= FLT_EPSILON;
+				scale[axisIdx] = amountOfBins / boundsDifference;
+			}
+
+			//Populate bins of all axes, every chunk fills its own set that is merged afterwards
+			std::vector<Bin> chunkBins(chunkCount * 3 * amountOfBins);
+			ParallelChunks(triangleCount, chunkCount, [&](unsigned int chunkIdx, unsigned int first, unsigned int last)
+				{
+					Bin* pBins{ &chunkBins[chunkIdx * 3 * amountOfBins] };
+					for (unsigned int triangleIdx{ firstTriangle + first }; triangleIdx < firstTriangle + last; ++triangleIdx)
+					{
+						const Vector3& centroid{ buildCentroids[triangleIdx] };
+						for (int axisIdx{}; axisIdx < 3; ++axisIdx)
+						{
+							if (!isAxisUsed[axisIdx]) continue;
+
+							const int binIdx{ std::min(amountOfPlaneBins, static_cast<int>((centroid[axisIdx] - centroidBounds.minAABB[axisIdx]) * scale[axisIdx])) };
+							Bin& bin{ pBins[axisIdx * amountOfBins + binIdx] };
+							bin.idxCount += 3;
+							bin.bounds.Grow(buildBounds[triangleIdx]);
+						}
+					}
+				});
+
+			float bestCost{ FLT_MAX };
+			//Loop over all axes with x = 0, y = 1, z = 2, to determine the best split axis
+			for (int axisIdx{}; axisIdx < 3; ++axisIdx)
+			{
+				if (!isAxisUsed[axisIdx]) continue;
+
+				const float minBounds{ centroidBounds.minAABB[axisIdx] };
+				const float boundsDifference{ centroidBounds.maxAABB[axisIdx] - minBounds };
+				Bin bins[amountOfBins];
+				for (unsigned int chunkIdx{}; chunkIdx < chunkCount; ++chunkIdx)
+				{
+					for (int binIdx{}; binIdx < amountOfBins; ++binIdx)
+					{
+						const Bin& chunkBin{ chunkBins[(chunkIdx * 3 + axisIdx) * amountOfBins + binIdx] };
+						bins[binIdx].idxCount += chunkBin.idxCount;
+						bins[binIdx].bounds.Grow(chunkBin.bounds);
+					}
+				}
+
+				//Gather data for binAmount - 1 planes for binAmount planes
+				float leftArea[amountOfPlaneBins]{};
+				float rightArea[amountOfPlaneBins]{};
+				int leftCount[amountOfPlaneBins]{};
+				int rightCount[amountOfPlaneBins]{};
+				int leftSum{};
+				int rightSum{};
+				AABB leftBox;
+				AABB rightBox;
+
+				for (int i{}; i < amountOfPlaneBins; ++i)
+				{
+					//Left side
+					leftSum += bins[i].idxCount;
+					leftCount[i] = leftSum;
+					leftBox.Grow(bins[i].bounds);
+					leftArea[i] = leftBox.Area();
+
+					//Right side
+					rightSum += bins[amountOfPlaneBins - i].idxCount;
+					rightCount[amountOfPlaneBins - i - 1] = rightSum;
+					rightBox.Grow(bins[amountOfPlaneBins - i].bounds);
+					rightArea[amountOfPlaneBins - i - 1] = rightBox.Area();
+				}
+
+				//calculate SAH cost for the binAmount - 1 planes
+				const float binWidth{ boundsDifference / amountOfBins };
+				for (int i{}; i < amountOfPlaneBins; ++i)
+				{
+					const float planeCost{ leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i] };
+					if (planeCost < bestCost)
+					{
+						axis = axisIdx;
+						splitPos = minBounds + binWidth * (i + 1);
+						bestCost = planeCost;
+					}
+				}
+			}
+			return bestCost;
+		}
+
+		//Unused
+		float EvalulateSAH(BVHNode& node, int axis, float pos)
+		{
+			AABB leftBox{};
+			AABB rightBox{};
+			int leftCount{};
+			int rightCount{};
+			for (unsigned int idx{}; idx < node.idxCount; idx += 3)
+			{
+				const unsigned int idxOffset{ node.leftFirst + idx };
+				const Vector3& v0{ positions[indices[idxOffset]] };
+				const Vector3& v1{ positions[indices[idxOffset + 1]] };
+				const Vector3& v2{ positions[indices[idxOffset + 2]] };
+				const Vector3 centroid{ (v0 + v1 + v2) / 3.f };
+
+				if (centroid[axis] > pos)
+				{
+					++leftCount;
+					leftBox.Grow(v0);
+					leftBox.Grow(v1);
+					leftBox.Grow(v2);
+				}
+				else
+				{
+					++rightCount;
+					rightBox.Grow(v0);
 					rightBox.Grow(v1);
 					rightBox.Grow(v2);
 				}
@@ -517,6 +1854,212 @@ namespace dae
 			return cost > 0 ? cost : FLT_MAX;
 		}
 	};
+
+	struct TLASNode
+	{
+		Vector3 minAABB{ Vector3::MaxVector };
+		Vector3 maxAABB{ Vector3::MinVector };
+		unsigned int firstIdx;
+		unsigned int idxCount;
+		unsigned int leftNode;
+		bool IsLeaf() const
+		{
+			return idxCount > 0;
+		};
+	};
+
+	//Top level acceleration structure over the world bounds of all bounded objects (spheres and mesh instances).
+	//Each mesh's own BVH acts as the bottom level, unbounded planes are kept out of the tree.
+	struct TLAS
+	{
+		std::vector<TLASNode> nodes{};
+		std::vector<unsigned int> instanceIndices{};
+		unsigned int nodesUsed{};
+
+		unsigned int GetInstanceCount() const
+		{
+			return static_cast<unsigned int>(instanceIndices.size());
+		}
+
+		void Build(const std::vector<AABB>& instanceBounds)
+		{
+			const unsigned int instanceCount{ static_cast<unsigned int>(instanceBounds.size()) };
+			instanceIndices.resize(instanceCount);
+			for (unsigned int idx{}; idx < instanceCount; ++idx)
+			{
+				instanceIndices[idx] = idx;
+			}
+
+			nodesUsed = 0;
+			if (instanceCount == 0) return;
+
+			//A binary tree over N instances never needs more than 2N - 1 nodes
+			nodes.clear();
+			nodes.resize(2 * instanceCount - 1);
+
+			TLASNode& root{ nodes[0] };
+			root.leftNode = 0;
+			root.firstIdx = 0;
+			root.idxCount = instanceCount;
+			nodesUsed = 1;
+
+			UpdateNodeBounds(0, instanceBounds);
+			Subdivide(0, instanceBounds, 0);
+		}
+
+		//Recalculates the bounds bottom-up while keeping the topology, used when only the transforms changed
+		void Refit(const std::vector<AABB>& instanceBounds)
+		{
+			//Children are always created after their parent, so walking backwards handles them first
+			for (int nodeIdx{ static_cast<int>(nodesUsed) - 1 }; nodeIdx >= 0; --nodeIdx)
+			{
+				TLASNode& node{ nodes[nodeIdx] };
+				if (node.IsLeaf())
+				{
+					UpdateNodeBounds(nodeIdx, instanceBounds);
+					continue;
+				}
+
+				const TLASNode& leftNode{ nodes[node.leftNode] };
+				const TLASNode& rightNode{ nodes[node.leftNode + 1] };
+				node.minAABB = Vector3::Min(leftNode.minAABB, rightNode.minAABB);
+				node.maxAABB = Vector3::Max(leftNode.maxAABB, rightNode.maxAABB);
+			}
+		}
+
+		void UpdateNodeBounds(unsigned int nodeIdx, const std::vector<AABB>& instanceBounds)
+		{
+			TLASNode& node{ nodes[nodeIdx] };
+			const AABB& firstBounds{ instanceBounds[instanceIndices[node.firstIdx]] };
+			node.minAABB = firstBounds.minAABB;
+			node.maxAABB = firstBounds.maxAABB;
+			for (unsigned int i{ node.firstIdx + 1 }; i < (node.firstIdx + node.idxCount); ++i)
+			{
+				const AABB& bounds{ instanceBounds[instanceIndices[i]] };
+				node.minAABB = Vector3::Min(node.minAABB, bounds.minAABB);
+				node.maxAABB = Vector3::Max(node.maxAABB, bounds.maxAABB);
+			}
+		}
+
+		void Subdivide(unsigned int nodeIdx, const std::vector<AABB>& instanceBounds, unsigned int depth)
+		{
+			//Terminate Recursion if necessary
+			TLASNode& node{ nodes[nodeIdx] };
+			if (node.idxCount <= 2 || depth + 1 >= maxBVHDepth) return;
+
+			int axis{ 0 };
+			float splitPos{};
+			const float splitCost{ FindBestSplitPlane(node, instanceBounds, axis, splitPos) };
+			Vector3 extent{ node.maxAABB - node.minAABB };
+			const float noSplitCost{ node.idxCount * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x) };
+			if (splitCost >= noSplitCost) return;
+
+			//Partitioning
+			int i{ static_cast<int>(node.firstIdx) };
+			int j{ i + static_cast<int>(node.idxCount) - 1 };
+			while (i <= j)
+			{
+				const AABB& bounds{ instanceBounds[instanceIndices[i]] };
+				const float centroid{ (bounds.minAABB[axis] + bounds.maxAABB[axis]) * 0.5f };
+				if (centroid < splitPos)
+				{
+					++i;
+				}
+				else
+				{
+					std::swap(instanceIndices[i], instanceIndices[j--]);
+				}
+			}
+
+			const unsigned int leftCount{ i - node.firstIdx };
+			if (leftCount == 0 || leftCount == node.idxCount) return;
+
+			//Setting Data
+			const unsigned int leftNodeIdx{ nodesUsed++ };
+			const unsigned int rightNodeIdx{ nodesUsed++ };
+
+			nodes[leftNodeIdx].firstIdx = node.firstIdx;
+			nodes[leftNodeIdx].idxCount = leftCount;
+			nodes[rightNodeIdx].firstIdx = static_cast<unsigned int>(i);
+			nodes[rightNodeIdx].idxCount = node.idxCount - leftCount;
+			node.leftNode = leftNodeIdx;
+			node.idxCount = 0;
+
+			UpdateNodeBounds(leftNodeIdx, instanceBounds);
+			UpdateNodeBounds(rightNodeIdx, instanceBounds);
+
+			Subdivide(leftNodeIdx, instanceBounds, depth + 1);
+			Subdivide(rightNodeIdx, instanceBounds, depth + 1);
+		}
+
+		float FindBestSplitPlane(const TLASNode& node, const std::vector<AABB>& instanceBounds, int& axis, float& splitPos) const
+		{
+			float bestCost{ FLT_MAX };
+			for (int axisIdx{}; axisIdx < 3; ++axisIdx)
+			{
+				float minBounds{ FLT_MAX };
+				float maxBounds{ -FLT_MAX };
+				for (unsigned int i{ node.firstIdx }; i < node.firstIdx + node.idxCount; ++i)
+				{
+					const AABB& bounds{ instanceBounds[instanceIndices[i]] };
+					const float centroid{ (bounds.minAABB[axisIdx] + bounds.maxAABB[axisIdx]) * 0.5f };
+					minBounds = std::min(minBounds, centroid);
+					maxBounds = std::max(maxBounds, centroid);
+				}
+				const float boundsDifference{ maxBounds - minBounds };
+				if (boundsDifference < FLT_EPSILON) continue;
+
+				//Populate bins with instance bounds
+				const int amountOfBins{ 8 };
+				const int amountOfPlaneBins{ amountOfBins - 1 };
+				Bin bins[amountOfBins];
+				const float scale{ amountOfBins / boundsDifference };
+				for (unsigned int i{ node.firstIdx }; i < node.firstIdx + node.idxCount; ++i)
+				{
+					const AABB& bounds{ instanceBounds[instanceIndices[i]] };
+					const float centroid{ (bounds.minAABB[axisIdx] + bounds.maxAABB[axisIdx]) * 0.5f };
+					const int binIdx{ std::min(amountOfPlaneBins, static_cast<int>((centroid - minBounds) * scale)) };
+					++bins[binIdx].idxCount;
+					bins[binIdx].bounds.Grow(bounds);
+				}
+
+				//Sweep from both sides to get the cost of every plane between two bins
+				float leftArea[amountOfPlaneBins]{};
+				float rightArea[amountOfPlaneBins]{};
+				unsigned int leftCount[amountOfPlaneBins]{};
+				unsigned int rightCount[amountOfPlaneBins]{};
+				unsigned int leftSum{};
+				unsigned int rightSum{};
+				AABB leftBox{};
+				AABB rightBox{};
+				for (int i{}; i < amountOfPlaneBins; ++i)
+				{
+					leftSum += bins[i].idxCount;
+					leftCount[i] = leftSum;
+					leftBox.Grow(bins[i].bounds);
+					leftArea[i] = leftBox.Area();
+
+					rightSum += bins[amountOfPlaneBins - i].idxCount;
+					rightCount[amountOfPlaneBins - i - 1] = rightSum;
+					rightBox.Grow(bins[amountOfPlaneBins - i].bounds);
+					rightArea[amountOfPlaneBins - i - 1] = rightBox.Area();
+				}
+
+				const float planeScale{ boundsDifference / amountOfBins };
+				for (int i{}; i < amountOfPlaneBins; ++i)
+				{
+					const float planeCost{ leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i] };
+					if (planeCost < bestCost)
+					{
+						axis = axisIdx;
+						splitPos = minBounds + planeScale * (i + 1);
+						bestCost = planeCost;
+					}
+				}
+			}
+			return bestCost;
+		}
+	};
 #pragma endregion
 #pragma region LIGHT
 	enum class LightType
@@ -562,6 +2105,126 @@ namespace dae
 			, max {maxDistance}
 		{
 		}
+
+		//For rays whose inversed direction is already known (ray packets)
+		Ray(const Vector3& origin, const Vector3& dir, const Vector3& inversedDir, float minDistance, float maxDistance)
+			: origin{origin}
+			, direction{dir}
+			, inversedDir{inversedDir}
+			, min {minDistance}
+			, max {maxDistance}
+		{
+		}
+	};
+
+	//Rays sharing an origin that are traced together, laid out as a row major grid of width x height rays so the
+	//corner rays span every ray in between. Directions are stored per axis for the SIMD leaf tests.
+	struct alignas(16) RayPacket
+	{
+		static constexpr unsigned int maxWidth{ 8 };
+		static constexpr unsigned int maxSize{ maxWidth * maxWidth };
+
+		float directionX[maxSize];
+		float directionY[maxSize];
+		float directionZ[maxSize];
+		float inversedDirX[maxSize];
+		float inversedDirY[maxSize];
+		float inversedDirZ[maxSize];
+
+		Vector3 origin{};
+		unsigned int width{};
+		unsigned int height{};
+		float min{ 0.0001f };
+
+		//Planes through the origin enclosing all rays, the normals point inwards
+		Vector3 frustumNormals[4]{};
+		//Longest direction, a box at distance d from the origin can not be entered before t = d / maxDirectionLength
+		float maxDirectionLength{};
+
+		unsigned int GetSize() const
+		{
+			return width * height;
+		}
+
+		void SetDirection(unsigned int rayIdx, const Vector3& direction)
+		{
+			directionX[rayIdx] = direction.x;
+			directionY[rayIdx] = direction.y;
+			directionZ[rayIdx] = direction.z;
+			inversedDirX[rayIdx] = 1.f / direction.x;
+			inversedDirY[rayIdx] = 1.f / direction.y;
+			inversedDirZ[rayIdx] = 1.f / direction.z;
+		}
+
+		Vector3 GetDirection(unsigned int rayIdx) const
+		{
+			return { directionX[rayIdx], directionY[rayIdx], directionZ[rayIdx] };
+		}
+
+		Ray GetRay(unsigned int rayIdx) const
+		{
+			return { origin, GetDirection(rayIdx), { inversedDirX[rayIdx], inversedDirY[rayIdx], inversedDirZ[rayIdx] }, min, FLT_MAX };
+		}
+
+		//Has to be called once all directions are set
+		void UpdateFrustum()
+		{
+			const unsigned int size{ GetSize() };
+			const Vector3 corners[4]{ GetDirection(0), GetDirection(width - 1), GetDirection(size - 1), GetDirection(size - width) };
+			const Vector3 center{ corners[0] + corners[1] + corners[2] + corners[3] };
+			for (int i{}; i < 4; ++i)
+			{
+				//Degenerate packets (a single row or column) end up with zero normals, which never cull anything
+				frustumNormals[i] = Vector3::Cross(corners[i], corners[(i + 1) % 4]);
+				if (Vector3::Dot(frustumNormals[i], center) < 0.f)
+				{
+					frustumNormals[i] = -frustumNormals[i];
+				}
+			}
+
+			maxDirectionLength = 0.f;
+			for (unsigned int rayIdx{}; rayIdx < size; ++rayIdx)
+			{
+				maxDirectionLength = std::max(maxDirectionLength, GetDirection(rayIdx).Magnitude());
+			}
+		}
+	};
+
+	//Rays stored per component, for streams of rays that one stage emits and the next one traces
+	struct RayStream
+	{
+		std::vector<float> originX{};
+		std::vector<float> originY{};
+		std::vector<float> originZ{};
+		std::vector<float> directionX{};
+		std::vector<float> directionY{};
+		std::vector<float> directionZ{};
+		std::vector<float> maxDistance{};
+		float min{ 0.0001f };
+
+		void Resize(size_t size)
+		{
+			for (std::vector<float>* pComponent : { &originX, &originY, &originZ, &directionX, &directionY, &directionZ, &maxDistance })
+			{
+				pComponent->resize(size);
+			}
+		}
+
+		void SetRay(size_t rayIdx, const Vector3& origin, const Vector3& direction, float maxRayDistance)
+		{
+			originX[rayIdx] = origin.x;
+			originY[rayIdx] = origin.y;
+			originZ[rayIdx] = origin.z;
+			directionX[rayIdx] = direction.x;
+			directionY[rayIdx] = direction.y;
+			directionZ[rayIdx] = direction.z;
+			maxDistance[rayIdx] = maxRayDistance;
+		}
+
+		Ray GetRay(size_t rayIdx) const
+		{
+			return { { originX[rayIdx], originY[rayIdx], originZ[rayIdx] }, { directionX[rayIdx], directionY[rayIdx], directionZ[rayIdx] }, min, maxDistance[rayIdx] };
+		}
 	};
 
 	struct HitRecord
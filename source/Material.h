@@ -1,48 +1,111 @@
 #pragma once
+#include <variant>
+#include <immintrin.h>
+
 #include "Math.h"
 #include "DataTypes.h"
 #include "BRDFs.h"
+#include "RayStatistics.h"
 
 namespace dae
 {
-#pragma region Material BASE
-	class Material
+#pragma region Material BATCH
+	//Normals, light and view directions of a batch of samples that use the same material, stored per component.
+	//The kernels run over 4 samples at a time, the lanes past count up to GetPaddedCount() must hold finite values.
+	struct ShadingBatch
 	{
-	public:
-		Material() = default;
-		virtual ~Material() = default;
+		static constexpr unsigned int maxSize{ 256 };
 
-		Material(const Material&) = delete;
-		Material(Material&&) noexcept = delete;
-		Material& operator=(const Material&) = delete;
-		Material& operator=(Material&&) noexcept = delete;
+		alignas(16) float normalX[maxSize];
+		alignas(16) float normalY[maxSize];
+		alignas(16) float normalZ[maxSize];
+		alignas(16) float lightX[maxSize];
+		alignas(16) float lightY[maxSize];
+		alignas(16) float lightZ[maxSize];
+		alignas(16) float viewX[maxSize];
+		alignas(16) float viewY[maxSize];
+		alignas(16) float viewZ[maxSize];
+		unsigned int count{};
 
-		/**
-		 * \brief Function used to calculate the correct color for the specific material and its parameters
-		 * \param hitRecord current hitrecord
-		 * \param l light direction
-		 * \param v view direction
-		 * \return color
-		 */
-		virtual ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) = 0;
+		unsigned int GetPaddedCount() const { return (count + 3) & ~3u; }
+
+		void SetSample(unsigned int sampleIdx, const Vector3& n, const Vector3& v)
+		{
+			normalX[sampleIdx] = n.x;
+			normalY[sampleIdx] = n.y;
+			normalZ[sampleIdx] = n.z;
+			viewX[sampleIdx] = v.x;
+			viewY[sampleIdx] = v.y;
+			viewZ[sampleIdx] = v.z;
+		}
+
+		void SetLightDirection(unsigned int sampleIdx, const Vector3& l)
+		{
+			lightX[sampleIdx] = l.x;
+			lightY[sampleIdx] = l.y;
+			lightZ[sampleIdx] = l.z;
+		}
 	};
+
+	//A color per sample of a batch, stored per component
+	struct ColorBatch
+	{
+		alignas(16) float r[ShadingBatch::maxSize];
+		alignas(16) float g[ShadingBatch::maxSize];
+		alignas(16) float b[ShadingBatch::maxSize];
+
+		void Fill(unsigned int count, const ColorRGB& color)
+		{
+			std::fill(r, r + count, color.r);
+			std::fill(g, g + count, color.g);
+			std::fill(b, b + count, color.b);
+		}
+	};
+
+	//Runs the scalar Evaluate of a material over every sample of a batch, for materials without a batch kernel
+	template<typename MaterialType>
+	void EvaluateEachSample(const MaterialType& material, const ShadingBatch& batch, ColorBatch& brdfs)
+	{
+		for (unsigned int sampleIdx{}; sampleIdx < batch.GetPaddedCount(); ++sampleIdx)
+		{
+			const ColorRGB brdf{ material.Evaluate(
+				{ batch.normalX[sampleIdx], batch.normalY[sampleIdx], batch.normalZ[sampleIdx] },
+				{ batch.lightX[sampleIdx], batch.lightY[sampleIdx], batch.lightZ[sampleIdx] },
+				{ batch.viewX[sampleIdx], batch.viewY[sampleIdx], batch.viewZ[sampleIdx] }) };
+			brdfs.r[sampleIdx] = brdf.r;
+			brdfs.g[sampleIdx] = brdf.g;
+			brdfs.b[sampleIdx] = brdf.b;
+		}
+	}
 #pragma endregion
 
 #pragma region Material SOLID COLOR
 	//SOLID COLOR
 	//===========
-	class Material_SolidColor final : public Material
+	class Material_SolidColor final
 	{
 	public:
 		Material_SolidColor(const ColorRGB& color): m_Color(color)
 		{
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) override
+		/**
+		 * \brief Function used to calculate the correct color for the specific material and its parameters
+		 * \param n surface normal
+		 * \param l light direction
+		 * \param v view direction
+		 * \return color
+		 */
+		ColorRGB Evaluate(const Vector3& n, const Vector3& l, const Vector3& v) const
 		{
 			return m_Color;
 		}
 
+		void EvaluateBatch(const ShadingBatch& batch, ColorBatch& brdfs) const
+		{
+			brdfs.Fill(batch.GetPaddedCount(), m_Color);
+		}
+
 	private:
 		ColorRGB m_Color{colors::White};
 	};
@@ -51,44 +114,85 @@ namespace dae
 #pragma region Material LAMBERT
 	//LAMBERT
 	//=======
-	class Material_Lambert final : public Material
+	class Material_Lambert final
 	{
 	public:
 		Material_Lambert(const ColorRGB& diffuseColor, float diffuseReflectance) :
-			m_DiffuseColor(diffuseColor), m_DiffuseReflectance(diffuseReflectance){}
+			m_Diffuse(BRDF::Lambert(diffuseReflectance, diffuseColor)){}
+
+		ColorRGB Evaluate(const Vector3& n, const Vector3& l, const Vector3& v) const
+		{
+			return m_Diffuse;
+		}
 
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+		void EvaluateBatch(const ShadingBatch& batch, ColorBatch& brdfs) const
 		{
-			return BRDF::Lambert(m_DiffuseReflectance, m_DiffuseColor);
+			brdfs.Fill(batch.GetPaddedCount(), m_Diffuse);
 		}
 
 	private:
-		ColorRGB m_DiffuseColor{colors::White};
-		float m_DiffuseReflectance{1.f}; //kd
+		ColorRGB m_Diffuse{}; //kd * cd / PI, the same for every direction
 	};
 #pragma endregion
 
 #pragma region Material LAMBERT PHONG
 	//LAMBERT-PHONG
 	//=============
-	class Material_LambertPhong final : public Material
+	class Material_LambertPhong final
 	{
 	public:
 		Material_LambertPhong(const ColorRGB& diffuseColor, float kd, float ks, float phongExponent):
-			m_DiffuseColor(diffuseColor), m_DiffuseReflectance(kd), m_SpecularReflectance(ks),
+			m_Diffuse(BRDF::Lambert(kd, diffuseColor)), m_SpecularReflectance(ks),
 			m_PhongExponent(phongExponent)
 		{
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+		ColorRGB Evaluate(const Vector3& n, const Vector3& l, const Vector3& v) const
 		{
-			return BRDF::Lambert(m_DiffuseReflectance, m_DiffuseColor) +
-				BRDF::Phong(m_SpecularReflectance, m_PhongExponent, l, v, hitRecord.normal);
+			return m_Diffuse +
+				BRDF::Phong(m_SpecularReflectance, m_PhongExponent, l, v, n);
+		}
+
+		//BRDF::Phong over 4 samples at a time in the same order of operations, only the power stays scalar
+		void EvaluateBatch(const ShadingBatch& batch, ColorBatch& brdfs) const
+		{
+			const __m128 zero{ _mm_setzero_ps() };
+			const __m128 two{ _mm_set1_ps(2.f) };
+			for (unsigned int sampleIdx{}; sampleIdx < batch.GetPaddedCount(); sampleIdx += 4)
+			{
+				const __m128 normalX{ _mm_load_ps(batch.normalX + sampleIdx) };
+				const __m128 normalY{ _mm_load_ps(batch.normalY + sampleIdx) };
+				const __m128 normalZ{ _mm_load_ps(batch.normalZ + sampleIdx) };
+				const __m128 lightX{ _mm_load_ps(batch.lightX + sampleIdx) };
+				const __m128 lightY{ _mm_load_ps(batch.lightY + sampleIdx) };
+				const __m128 lightZ{ _mm_load_ps(batch.lightZ + sampleIdx) };
+
+				//reflect = l - 2 * max(n.l, 0) * n
+				const __m128 normalDotLight{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(normalX, lightX), _mm_mul_ps(normalY, lightY)), _mm_mul_ps(normalZ, lightZ)) };
+				const __m128 scale{ _mm_mul_ps(two, _mm_max_ps(zero, normalDotLight)) };
+				const __m128 reflectX{ _mm_sub_ps(lightX, _mm_mul_ps(normalX, scale)) };
+				const __m128 reflectY{ _mm_sub_ps(lightY, _mm_mul_ps(normalY, scale)) };
+				const __m128 reflectZ{ _mm_sub_ps(lightZ, _mm_mul_ps(normalZ, scale)) };
+
+				const __m128 reflectDotView{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(reflectX, _mm_load_ps(batch.viewX + sampleIdx)),
+					_mm_mul_ps(reflectY, _mm_load_ps(batch.viewY + sampleIdx))), _mm_mul_ps(reflectZ, _mm_load_ps(batch.viewZ + sampleIdx))) };
+				alignas(16) float cosAlpha[4];
+				_mm_store_ps(cosAlpha, _mm_max_ps(zero, reflectDotView));
+
+				alignas(16) float specular[4];
+				for (int lane{}; lane < 4; ++lane)
+				{
+					specular[lane] = m_SpecularReflectance * powf(cosAlpha[lane], m_PhongExponent);
+				}
+				const __m128 specularReflection{ _mm_load_ps(specular) };
+				_mm_store_ps(brdfs.r + sampleIdx, _mm_add_ps(_mm_set1_ps(m_Diffuse.r), specularReflection));
+				_mm_store_ps(brdfs.g + sampleIdx, _mm_add_ps(_mm_set1_ps(m_Diffuse.g), specularReflection));
+				_mm_store_ps(brdfs.b + sampleIdx, _mm_add_ps(_mm_set1_ps(m_Diffuse.b), specularReflection));
+			}
 		}
 
 	private:
-		ColorRGB m_DiffuseColor{colors::White};
-		float m_DiffuseReflectance{0.5f}; //kd
+		ColorRGB m_Diffuse{}; //kd * cd / PI
 		float m_SpecularReflectance{0.5f}; //ks
 		float m_PhongExponent{1.f}; //Phong Exponent
 	};
@@ -96,36 +200,84 @@ namespace dae
 
 #pragma region Material COOK TORRENCE
 	//COOK TORRENCE
-	class Material_CookTorrence final : public Material
+	class Material_CookTorrence final
 	{
 	public:
 		Material_CookTorrence(const ColorRGB& albedo, float metalness, float roughness):
-			m_Albedo(albedo), m_Metalness(metalness), m_Roughness(roughness)
+			m_DiffuseAlbedo(BRDF::Lambert(1.f, albedo)),
+			m_F0(metalness == 0.f ? ColorRGB{0.04f, 0.04f, 0.04f} : albedo),
+			m_AlphaSquared(Square(Square(roughness))),
+			m_K(Square(Square(roughness) + 1) / 8),
+			m_IsMetal(metalness != 0.f)
 		{
 		}
 
-		ColorRGB Shade(const HitRecord& hitRecord = {}, const Vector3& l = {}, const Vector3& v = {}) override
+		ColorRGB Evaluate(const Vector3& n, const Vector3& l, const Vector3& v) const
 		{
 			const Vector3 halfVector{ (v + l).Normalized()};
-			const ColorRGB f0{ (m_Metalness == 0.f ? ColorRGB{0.04f, 0.04f, 0.04f} : m_Albedo) };
-
-			const ColorRGB fresnel{ BRDF::FresnelFunction_Schlick(halfVector, v, f0) };
-			const float distribution{ BRDF::NormalDistribution_GGX(hitRecord.normal, halfVector, m_Roughness) };			
-			const float geometry{ BRDF::GeometryFunction_Smith(hitRecord.normal, v, l, m_Roughness) };
-			
-			const ColorRGB specular{ ColorRGB(fresnel * distribution * geometry) / (4 * std::max(Vector3::Dot(v, hitRecord.normal), 0.0001f) * std::max(Vector3::Dot(l, hitRecord.normal), 0.0001f)) };
-			const ColorRGB diffuse{ BRDF::Lambert((m_Metalness == 0.f ? ColorRGB{1, 1, 1} - fresnel : ColorRGB{}), m_Albedo) };
-			
-			
-
-			//return ColorRGB{1, 1, 1} * distribution;
+
+			const ColorRGB fresnel{ BRDF::FresnelFunction_Schlick(halfVector, v, m_F0) };
+			const float distribution{ BRDF::NormalDistribution_GGX_AlphaSquared(n, halfVector, m_AlphaSquared) };
+			const float geometry{ BRDF::GeometryFunction_Smith_K(n, v, l, m_K) };
+
+			const ColorRGB specular{ ColorRGB(fresnel * distribution * geometry) / (4 * std::max(Vector3::Dot(v, n), 0.0001f) * std::max(Vector3::Dot(l, n), 0.0001f)) };
+			//Metals have no diffuse part, dielectrics diffuse whatever is not reflected
+			const ColorRGB diffuse{ m_IsMetal ? ColorRGB{} : m_DiffuseAlbedo * (ColorRGB{1, 1, 1} - fresnel) };
+
 			return diffuse + specular;
 		}
 
+		//Fresnel, distribution and geometry terms are still evaluated per sample
+		void EvaluateBatch(const ShadingBatch& batch, ColorBatch& brdfs) const
+		{
+			EvaluateEachSample(*this, batch, brdfs);
+		}
+
+	private:
+		ColorRGB m_DiffuseAlbedo{}; //Lambert of the albedo, scaled by (1 - fresnel) per sample
+		ColorRGB m_F0{}; //Base reflectivity, 0.04 for dielectrics and the albedo for metals
+		float m_AlphaSquared{}; //roughness^4, (roughness^2)^2 of the UE4 GGX
+		float m_K{}; //Schlick GGX k for direct lighting
+		bool m_IsMetal{true};
+	};
+#pragma endregion
+
+#pragma region Material
+	//Closed set of materials stored by value, Shade dispatches on the type index instead of through a vtable
+	class Material final
+	{
+	public:
+		template<typename MaterialType>
+		Material(const MaterialType& material) : m_Material(material)
+		{
+		}
+
+		/**
+		 * \brief Function used to calculate the correct color for the specific material and its parameters
+		 * \param hitRecord current hitrecord
+		 * \param l light direction
+		 * \param v view direction
+		 * \return color
+		 */
+		ColorRGB Shade(const HitRecord& hitRecord, const Vector3& l, const Vector3& v) const
+		{
+			RayStatistics::Add(RayStatistics::Counter::BRDFEvaluations);
+			return std::visit([&](const auto& material) { return material.Evaluate(hitRecord.normal, l, v); }, m_Material);
+		}
+
+		/**
+		 * \brief Batched Shade, the type is only resolved once for all samples of the batch
+		 * \param batch normals, light and view directions of the samples
+		 * \param brdfs color per sample, the padding lanes are written as well
+		 */
+		void Shade(const ShadingBatch& batch, ColorBatch& brdfs) const
+		{
+			RayStatistics::Add(RayStatistics::Counter::BRDFEvaluations, batch.count);
+			std::visit([&](const auto& material) { material.EvaluateBatch(batch, brdfs); }, m_Material);
+		}
+
 	private:
-		ColorRGB m_Albedo{0.955f, 0.637f, 0.538f}; //Copper
-		float m_Metalness{1.0f};
-		float m_Roughness{0.1f}; // [1.0 > 0.0] >> [ROUGH > SMOOTH]
+		std::variant<Material_SolidColor, Material_Lambert, Material_LambertPhong, Material_CookTorrence> m_Material;
 	};
 #pragma endregion
 }
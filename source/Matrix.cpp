@@ -1,6 +1,7 @@
 #include "Matrix.h"
 
 #include <cassert>
+#include <cfloat>
 
 #include "MathHelpers.h"
 #include <cmath>
@@ -82,6 +83,39 @@ namespace dae {
 		return out;
 	}
 
+	//Inverse of an affine matrix (3x3 linear part + translation row)
+	const Matrix& Matrix::Inverse()
+	{
+		const Vector3 xAxis{ data[0] };
+		const Vector3 yAxis{ data[1] };
+		const Vector3 zAxis{ data[2] };
+		const Vector3 t{ data[3] };
+
+		//Rows of the adjugate are the cross products of the axes
+		const Vector3 crossYZ{ Vector3::Cross(yAxis, zAxis) };
+		const Vector3 crossZX{ Vector3::Cross(zAxis, xAxis) };
+		const Vector3 crossXY{ Vector3::Cross(xAxis, yAxis) };
+
+		const float determinant{ Vector3::Dot(xAxis, crossYZ) };
+		assert(abs(determinant) > FLT_EPSILON && "Matrix::Inverse >> Matrix is not invertible");
+		const float invDeterminant{ 1.f / determinant };
+
+		data[0] = { crossYZ.x * invDeterminant, crossZX.x * invDeterminant, crossXY.x * invDeterminant, 0.f };
+		data[1] = { crossYZ.y * invDeterminant, crossZX.y * invDeterminant, crossXY.y * invDeterminant, 0.f };
+		data[2] = { crossYZ.z * invDeterminant, crossZX.z * invDeterminant, crossXY.z * invDeterminant, 0.f };
+		data[3] = { -TransformVector(t), 1.f };
+
+		return *this;
+	}
+
+	Matrix Matrix::Inverse(const Matrix& m)
+	{
+		Matrix out{ m };
+		out.Inverse();
+
+		return out;
+	}
+
 	Vector3 Matrix::GetAxisX() const
 	{
 		return data[0];
@@ -0,0 +1,99 @@
+#include "PerfCounters.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace dae;
+
+#if defined(__linux__)
+namespace
+{
+	int OpenCacheCounter(uint64_t cache, uint64_t operation, uint64_t result)
+	{
+		perf_event_attr attributes{};
+		attributes.type = PERF_TYPE_HW_CACHE;
+		attributes.size = sizeof(perf_event_attr);
+		attributes.config = cache | (operation << 8) | (result << 16);
+		attributes.disabled = 1;
+		attributes.exclude_kernel = 1;
+		attributes.exclude_hv = 1;
+
+		//Calling thread only, on any cpu
+		return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+	}
+}
+#endif
+
+PerfCounters::PerfCounters()
+{
+	for (int& fileDescriptor : m_FileDescriptors)
+	{
+		fileDescriptor = -1;
+	}
+
+#if defined(__linux__)
+	m_FileDescriptors[static_cast<int>(Counter::L1DataMisses)] =
+		OpenCacheCounter(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS);
+	m_FileDescriptors[static_cast<int>(Counter::LastLevelMisses)] =
+		OpenCacheCounter(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS);
+	m_FileDescriptors[static_cast<int>(Counter::DataTLBMisses)] =
+		OpenCacheCounter(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS);
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#if defined(__linux__)
+	for (const int fileDescriptor : m_FileDescriptors)
+	{
+		if (fileDescriptor >= 0) close(fileDescriptor);
+	}
+#endif
+}
+
+void PerfCounters::Start()
+{
+#if defined(__linux__)
+	for (const int fileDescriptor : m_FileDescriptors)
+	{
+		if (fileDescriptor < 0) continue;
+		ioctl(fileDescriptor, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fileDescriptor, PERF_EVENT_IOC_ENABLE, 0);
+	}
+#endif
+}
+
+void PerfCounters::Stop()
+{
+	for (int i{}; i < static_cast<int>(Counter::Count); ++i)
+	{
+		m_Values[i] = 0;
+#if defined(__linux__)
+		if (m_FileDescriptors[i] < 0) continue;
+		ioctl(m_FileDescriptors[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(m_FileDescriptors[i], &m_Values[i], sizeof(uint64_t)) != sizeof(uint64_t))
+		{
+			m_Values[i] = 0;
+		}
+#endif
+	}
+}
+
+const char* PerfCounters::GetName(Counter counter)
+{
+	switch (counter)
+	{
+	case Counter::L1DataMisses:
+		return "L1D misses";
+	case Counter::LastLevelMisses:
+		return "LLC misses";
+	case Counter::DataTLBMisses:
+		return "dTLB misses";
+	default:
+		return "";
+	}
+}
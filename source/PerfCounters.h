@@ -0,0 +1,41 @@
+#pragma once
+
+//Standard includes
+#include <cstdint>
+
+namespace dae
+{
+	//Hardware cache counters of the calling thread, read through perf_event_open on Linux.
+	//Counters the kernel or CPU do not expose (and every counter on other platforms) report as unavailable.
+	class PerfCounters final
+	{
+	public:
+		enum class Counter
+		{
+			L1DataMisses,
+			LastLevelMisses,
+			DataTLBMisses,
+			//Define counters above
+			Count
+		};
+
+		PerfCounters();
+		~PerfCounters();
+
+		PerfCounters(const PerfCounters&) = delete;
+		PerfCounters(PerfCounters&&) noexcept = delete;
+		PerfCounters& operator=(const PerfCounters&) = delete;
+		PerfCounters& operator=(PerfCounters&&) noexcept = delete;
+
+		void Start();
+		void Stop();
+
+		bool IsAvailable(Counter counter) const { return m_FileDescriptors[static_cast<int>(counter)] >= 0; }
+		uint64_t GetValue(Counter counter) const { return m_Values[static_cast<int>(counter)]; }
+		static const char* GetName(Counter counter);
+
+	private:
+		int m_FileDescriptors[static_cast<int>(Counter::Count)]{};
+		uint64_t m_Values[static_cast<int>(Counter::Count)]{};
+	};
+}
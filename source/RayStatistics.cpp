@@ -0,0 +1,92 @@
+#include "RayStatistics.h"
+
+#ifdef RAY_STATISTICS
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#endif
+
+using namespace dae;
+
+#ifdef RAY_STATISTICS
+namespace
+{
+	//Counters of every live thread, plus what threads that already exited left behind
+	struct Registry
+	{
+		std::mutex mutex{};
+		std::vector<uint64_t*> threadValues{};
+		RayStatistics::Counts exitedCounts{};
+	};
+
+	//Constructed on first use, so it outlives the thread local counters that register in it
+	Registry& GetRegistry()
+	{
+		static Registry registry{};
+		return registry;
+	}
+}
+
+RayStatistics::ThreadCounts::ThreadCounts()
+{
+	Registry& registry{ GetRegistry() };
+	const std::lock_guard lock{ registry.mutex };
+	registry.threadValues.push_back(values);
+}
+
+RayStatistics::ThreadCounts::~ThreadCounts()
+{
+	Registry& registry{ GetRegistry() };
+	const std::lock_guard lock{ registry.mutex };
+	for (int i{}; i < static_cast<int>(Counter::Count); ++i)
+	{
+		registry.exitedCounts.values[i] += values[i];
+	}
+	registry.threadValues.erase(std::find(registry.threadValues.begin(), registry.threadValues.end(), values));
+}
+#endif
+
+RayStatistics::Counts RayStatistics::Collect()
+{
+	Counts counts{};
+#ifdef RAY_STATISTICS
+	Registry& registry{ GetRegistry() };
+	const std::lock_guard lock{ registry.mutex };
+	counts = registry.exitedCounts;
+	registry.exitedCounts = {};
+	for (uint64_t* pValues : registry.threadValues)
+	{
+		for (int i{}; i < static_cast<int>(Counter::Count); ++i)
+		{
+			counts.values[i] += pValues[i];
+			pValues[i] = 0;
+		}
+	}
+#endif
+	return counts;
+}
+
+const char* RayStatistics::GetName(Counter counter)
+{
+	switch (counter)
+	{
+	case Counter::PrimaryRays:
+		return "Primary rays";
+	case Counter::ShadowRays:
+		return "Shadow rays";
+	case Counter::BVHNodes:
+		return "BVH nodes";
+	case Counter::SlabTests:
+		return "Slab tests";
+	case Counter::TriangleTests:
+		return "Triangle tests";
+	case Counter::SphereTests:
+		return "Sphere tests";
+	case Counter::PlaneTests:
+		return "Plane tests";
+	case Counter::BRDFEvaluations:
+		return "BRDF evaluations";
+	default:
+		return "";
+	}
+}
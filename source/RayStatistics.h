@@ -0,0 +1,82 @@
+#pragma once
+
+//Standard includes
+#include <cstdint>
+
+//Counts the work of every ray, enabled by default in debug builds. Without it the counters compile out completely.
+//#define RAY_STATISTICS
+#if defined(_DEBUG) && !defined(RAY_STATISTICS)
+#define RAY_STATISTICS
+#endif
+
+namespace dae
+{
+	//Per thread counters of the work done by the rays. Every thread only increments its own plain counters,
+	//Collect sums them over all threads once no thread is rendering, so the hot path has no atomics or locks.
+	class RayStatistics final
+	{
+	public:
+		enum class Counter
+		{
+			PrimaryRays,
+			ShadowRays,
+			BVHNodes,
+			SlabTests,
+			TriangleTests,
+			SphereTests,
+			PlaneTests,
+			BRDFEvaluations,
+			//Define counters above
+			Count
+		};
+
+		struct Counts
+		{
+			uint64_t values[static_cast<int>(Counter::Count)]{};
+
+			uint64_t Get(Counter counter) const { return values[static_cast<int>(counter)]; }
+		};
+
+#ifdef RAY_STATISTICS
+		static constexpr bool isEnabled{ true };
+#else
+		static constexpr bool isEnabled{ false };
+#endif
+
+		RayStatistics() = delete;
+
+		static void Add(Counter counter, uint64_t amount = 1)
+		{
+#ifdef RAY_STATISTICS
+			s_ThreadCounts.values[static_cast<int>(counter)] += amount;
+#else
+			(void)counter;
+			(void)amount;
+#endif
+		}
+
+		//Sums the counts of all threads since the previous call and resets them.
+		//Only call while no other thread is tracing rays, e.g. after the render of a frame returned.
+		static Counts Collect();
+		static const char* GetName(Counter counter);
+
+	private:
+#ifdef RAY_STATISTICS
+		//Registers itself on first use by a thread, a thread that exits hands its counts over to the next Collect
+		struct ThreadCounts final
+		{
+			ThreadCounts();
+			~ThreadCounts();
+
+			ThreadCounts(const ThreadCounts&) = delete;
+			ThreadCounts(ThreadCounts&&) noexcept = delete;
+			ThreadCounts& operator=(const ThreadCounts&) = delete;
+			ThreadCounts& operator=(ThreadCounts&&) noexcept = delete;
+
+			uint64_t values[static_cast<int>(Counter::Count)]{};
+		};
+
+		inline static thread_local ThreadCounts s_ThreadCounts{};
+#endif
+	};
+}
@@ -1,7 +1,3 @@
-//External includes
-#include "SDL.h"
-#include "SDL_surface.h"
-
 //Project includes
 #include "Renderer.h"
 #include "Math.h"
@@ -10,113 +6,462 @@
 #include "Scene.h"
 #include "Utils.h"
 
+#include <cassert>
 #include <iostream>
-#include <thread>
-
-#include <future> //async stuff
-#include <ppl.h> //parallel stuff
+#include <numeric>
 
 using namespace dae;
 
-//#define ASYNC
-#define PARALLEL_FOR
+Renderer::Renderer(int width, int height) :
+	m_Width(width),
+	m_Height(height),
+	m_AspectRatio(width / static_cast<float>(height))
+{
+}
 
-Renderer::Renderer(SDL_Window * pWindow) :
-	m_pWindow(pWindow),
-	m_pBuffer(SDL_GetWindowSurface(pWindow))
+bool Renderer::Render(Scene* pScene, const FrameBuffer& target)
 {
-	//Initialize
-	SDL_GetWindowSize(pWindow, &m_Width, &m_Height);
-	m_pBufferPixels = static_cast<uint32_t*>(m_pBuffer->pixels);
-	m_AspectRatio = m_Width / static_cast<float>(m_Height);
+	return Render(pScene, target, { 0, 0, m_Width, m_Height });
+}
+
+bool Renderer::Render(Scene* pScene, const FrameBuffer& target, const Rect& region)
+{
+	const bool isInside{ region.x >= 0 && region.y >= 0 && region.width >= 0 && region.height >= 0
+		&& region.width <= m_Width - region.x && region.height <= m_Height - region.y };
+	assert(isInside);
+	if (!isInside || target.pPixels == nullptr || target.rowPitch < region.width) return false;
+	if (region.width == 0 || region.height == 0) return true;
+	m_Target = target;
+	m_Region = region;
+
+	//Drops what the calling thread traced since the previous frame, e.g. the rays of a BVH benchmark
+	if constexpr (RayStatistics::isEnabled)
+	{
+		RayStatistics::Collect();
+	}
+
+	using RenderFrameFunction = void (Renderer::*)(Scene*);
+	//Indexed by lighting mode and shadow toggle
+	static constexpr RenderFrameFunction renderFrameFunctions[static_cast<int>(LightingMode::Count)][2]
+	{
+		{ &Renderer::RenderFrame<LightingMode::ObservedArea, false>, &Renderer::RenderFrame<LightingMode::ObservedArea, true> },
+		{ &Renderer::RenderFrame<LightingMode::Radiance, false>, &Renderer::RenderFrame<LightingMode::Radiance, true> },
+		{ &Renderer::RenderFrame<LightingMode::BRDF, false>, &Renderer::RenderFrame<LightingMode::BRDF, true> },
+		{ &Renderer::RenderFrame<LightingMode::Combined, false>, &Renderer::RenderFrame<LightingMode::Combined, true> }
+	};
+	(this->*renderFrameFunctions[static_cast<int>(m_CurrentLightingMode)][m_ShadowsEnabled])(pScene);
+
+	//The pool is idle again, so the counters of its threads can be read
+	if constexpr (RayStatistics::isEnabled)
+	{
+		m_RayCounts = RayStatistics::Collect();
+	}
+	return true;
 }
 
-void Renderer::Render(Scene* pScene) const
+template<Renderer::LightingMode lightingMode, bool shadowsEnabled>
+void Renderer::RenderFrame(Scene* pScene)
 {
 	Camera& camera = pScene->GetCamera();
 	auto& materials = pScene->GetMaterials();
 	auto& lights = pScene->GetLights();
-	const uint32_t numPixels = m_Width * m_Height;
+	const int numTilesX = GetNumTilesX();
+	const int numFrameTilesX = (m_Region.width + m_FrameTileSize - 1) / m_FrameTileSize;
+	const uint32_t numFrameTiles = numFrameTilesX * ((m_Region.height + m_FrameTileSize - 1) / m_FrameTileSize);
 	camera.CalculateCameraToWorld();
 
-#if defined(ASYNC)
-	//async
-	const uint32_t numCores{ std::thread::hardware_concurrency() };
-	std::vector<std::future<void>> async_futures{};
-	const uint32_t numPixelsPerTask{ numPixels / numCores };
-	uint32_t numUnnassignedPixels = { numPixels % numCores };
-	uint32_t currPixelIndex{};
+	//Frame tiles cover the region, the ones along its right and bottom edge can be smaller
+	const auto getFrameTileBounds = [&](uint32_t frameTileIndex, int& firstX, int& firstY, int& lastX, int& lastY)
+		{
+			firstX = m_Region.x + (frameTileIndex % numFrameTilesX) * m_FrameTileSize;
+			firstY = m_Region.y + (frameTileIndex / numFrameTilesX) * m_FrameTileSize;
+			lastX = std::min(firstX + m_FrameTileSize, m_Region.x + m_Region.width);
+			lastY = std::min(firstY + m_FrameTileSize, m_Region.y + m_Region.height);
+		};
 
-	//Create Tasks
-	for (uint32_t coreId{}; coreId < numCores; ++coreId)
+	switch (m_CurrentRenderMode)
 	{
-		uint32_t taskSize{ numPixelsPerTask };
-		if (numUnnassignedPixels > 0)
-		{
-			++taskSize;
-			--numUnnassignedPixels;
-		}
-		async_futures.push_back(
-			std::async(std::launch::async, [=,this] 
+	case RenderMode::SingleRay:
+		m_pThreadPool->ParallelFor(numFrameTiles, 1, [&](uint32_t frameTileIndex)
+			{
+				int firstX{}, firstY{}, lastX{}, lastY{};
+				getFrameTileBounds(frameTileIndex, firstX, firstY, lastX, lastY);
+				for (int py{ firstY }; py < lastY; ++py)
 				{
-					const uint32_t pixelIndexEnd{ currPixelIndex + taskSize };
-					for (uint32_t pixelIndex{ currPixelIndex }; pixelIndex < pixelIndexEnd; ++pixelIndex)
+					for (int px{ firstX }; px < lastX; ++px)
 					{
-						RenderPixel(pScene, pixelIndex, m_AspectRatio, camera, lights, materials);
+						RenderPixel<lightingMode, shadowsEnabled>(pScene, px, py, camera, lights, materials);
 					}
 				}
-			)
-		);
-		currPixelIndex += taskSize;
+			});
+		break;
+	case RenderMode::Packets:
+		//Frame tiles are a multiple of the packet tile size, so every packet tile lies in a single frame tile
+		m_pThreadPool->ParallelFor(numFrameTiles, 1, [&](uint32_t frameTileIndex)
+			{
+				int firstX{}, firstY{}, lastX{}, lastY{};
+				getFrameTileBounds(frameTileIndex, firstX, firstY, lastX, lastY);
+				for (int y{ firstY }; y < lastY; y += tileSize)
+				{
+					for (int x{ firstX }; x < lastX; x += tileSize)
+					{
+						const uint32_t tileIndex = ((y - m_Region.y) / tileSize) * numTilesX + (x - m_Region.x) / tileSize;
+						RenderTile<lightingMode, shadowsEnabled>(pScene, tileIndex, camera, lights, materials);
+					}
+				}
+			});
+		break;
+	case RenderMode::Wavefront:
+		RenderWavefront<lightingMode, shadowsEnabled>(pScene, camera, lights, materials);
+		break;
+	default:
+		break;
 	}
+}
+
+template<Renderer::LightingMode lightingMode, bool shadowsEnabled>
+void dae::Renderer::RenderPixel(Scene* pScene, int px, int py, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material>& materials) const
+{
+	//Calculate view direction & ray
+	const Vector3 viewDirection{ camera.GetPrimaryRayDirection(px, py, m_Width, m_Height, m_AspectRatio) };
+	const Ray viewRay{ camera.origin,  viewDirection };
+	RayStatistics::Add(RayStatistics::Counter::PrimaryRays);
+
+	//Attempt to hit an object with the calculated ray
+	HitRecord closestHit{};
+	pScene->GetClosestHit(viewRay, closestHit);
 
-	//Wait for all tasks;
-	for (const std::future<void>& f : async_futures)
+	ShadePixel<lightingMode, shadowsEnabled>(pScene, px, py, viewDirection, closestHit, lights, materials);
+}
+
+template<Renderer::LightingMode lightingMode, bool shadowsEnabled>
+void dae::Renderer::RenderTile(Scene* pScene, uint32_t tileIndex, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material>& materials) const
+{
+	RayPacket packet{};
+	GeneratePrimaryPacket(tileIndex, camera, packet);
+
+	HitRecord closestHits[RayPacket::maxSize]{};
+	pScene->GetClosestHit(packet, closestHits);
+
+	int firstX{}, firstY{};
+	GetTileOrigin(tileIndex, firstX, firstY);
+	for (uint32_t rayIdx{}; rayIdx < packet.GetSize(); ++rayIdx)
 	{
-		f.wait();
+		const int px = firstX + rayIdx % packet.width;
+		const int py = firstY + rayIdx / packet.width;
+		ShadePixel<lightingMode, shadowsEnabled>(pScene, px, py, packet.GetDirection(rayIdx), closestHits[rayIdx], lights, materials);
 	}
+}
 
-#elif (defined(PARALLEL_FOR))
-	//parallel
-	concurrency::parallel_for(0u, numPixels, [=, this](int i)
+void dae::Renderer::GetTileOrigin(uint32_t tileIndex, int& firstX, int& firstY) const
+{
+	const int numTilesX = GetNumTilesX();
+	firstX = m_Region.x + (tileIndex % numTilesX) * tileSize;
+	firstY = m_Region.y + (tileIndex / numTilesX) * tileSize;
+}
+
+void dae::Renderer::GeneratePrimaryPacket(uint32_t tileIndex, const Camera& camera, RayPacket& packet) const
+{
+	int firstX{}, firstY{};
+	GetTileOrigin(tileIndex, firstX, firstY);
+
+	packet.origin = camera.origin;
+	packet.width = std::min(tileSize, m_Region.x + m_Region.width - firstX);
+	packet.height = std::min(tileSize, m_Region.y + m_Region.height - firstY);
+	for (uint32_t y{}; y < packet.height; ++y)
+	{
+		for (uint32_t x{}; x < packet.width; ++x)
 		{
-			RenderPixel(pScene, i, m_AspectRatio, camera, lights, materials);
+			const int px = firstX + x;
+			const int py = firstY + y;
+			packet.SetDirection(y * packet.width + x, camera.GetPrimaryRayDirection(px, py, m_Width, m_Height, m_AspectRatio));
 		}
-	);
-#else
-	//synchronous
-	for (uint32_t i{}; i < numPixels; ++i)
-	{
-		RenderPixel(pScene, i, m_AspectRatio, camera, lights, materials);
 	}
-#endif
-	
-
-	//@END
-	//Update SDL Surface
-	SDL_UpdateWindowSurface(m_pWindow);
+	packet.UpdateFrustum();
+	RayStatistics::Add(RayStatistics::Counter::PrimaryRays, packet.GetSize());
 }
 
-void dae::Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const
+//Every stage runs over the whole region before the next one starts, each one batched per tile:
+//generate primary packets > intersect > compact the hits > emit and trace the shadow rays > bin per material > shade
+template<Renderer::LightingMode lightingMode, bool shadowsEnabled>
+void dae::Renderer::RenderWavefront(Scene* pScene, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material>& materials)
 {
+	const uint32_t numTiles = GetNumTilesX() * ((m_Region.height + tileSize - 1) / tileSize);
+	const uint32_t numLights = static_cast<uint32_t>(lights.size());
+	m_PrimaryPackets.resize(numTiles);
+	m_PrimaryHits.resize(numTiles * RayPacket::maxSize);
+	m_TileHitOffsets.resize(numTiles + 1);
+	const uint32_t tilesPerTask = (m_FrameTileSize / tileSize) * (m_FrameTileSize / tileSize);
 
-	//Calculate pixel locations and pixel centers
-	const int px = pixelIndex % m_Width;
-	const int py = pixelIndex / m_Width;
-	
-	const float cx = (2.f * ((px + 0.5f) / m_Width) - 1) * m_AspectRatio * camera.fov;
-	const float cy = (1.f - (2.f * (py + 0.5f) / m_Height)) * camera.fov;
+	const auto getPixel = [&](uint32_t primaryIdx, int& px, int& py)
+		{
+			const uint32_t tileIndex{ primaryIdx / RayPacket::maxSize };
+			const uint32_t rayIdx{ primaryIdx % RayPacket::maxSize };
+			const RayPacket& packet{ m_PrimaryPackets[tileIndex] };
+			GetTileOrigin(tileIndex, px, py);
+			px += rayIdx % packet.width;
+			py += rayIdx / packet.width;
+		};
 
+	//Generate
+	m_pThreadPool->ParallelFor(numTiles, tilesPerTask, [&](uint32_t tileIndex)
+		{
+			GeneratePrimaryPacket(tileIndex, camera, m_PrimaryPackets[tileIndex]);
+		});
 
-	//Calculate view direction & ray
-	Vector3 viewDirection{ camera.cameraToWorld.TransformVector(cx, cy, 1) };
-	viewDirection.Normalize();
-	const Ray viewRay{ camera.origin,  viewDirection };
+	//Intersect
+	m_pThreadPool->ParallelFor(numTiles, tilesPerTask, [&](uint32_t tileIndex)
+		{
+			HitRecord* pHits{ m_PrimaryHits.data() + tileIndex * RayPacket::maxSize };
+			std::fill(pHits, pHits + RayPacket::maxSize, HitRecord{});
+			pScene->GetClosestHit(m_PrimaryPackets[tileIndex], pHits);
+		});
 
-	//Attempt to hit an object with the calculated ray
-	HitRecord closestHit{};
-	pScene->GetClosestHit(viewRay, closestHit);
+	//Compact: count the hits per tile and clear the pixels that missed, then gather the hits
+	m_pThreadPool->ParallelFor(numTiles, tilesPerTask, [&](uint32_t tileIndex)
+		{
+			uint32_t hitCount{};
+			for (uint32_t rayIdx{}; rayIdx < m_PrimaryPackets[tileIndex].GetSize(); ++rayIdx)
+			{
+				const uint32_t primaryIdx{ tileIndex * RayPacket::maxSize + rayIdx };
+				if (m_PrimaryHits[primaryIdx].didHit)
+				{
+					++hitCount;
+					continue;
+				}
+
+				int px{}, py{};
+				getPixel(primaryIdx, px, py);
+				WritePixel(px, py, ColorRGB{});
+			}
+			m_TileHitOffsets[tileIndex + 1] = hitCount;
+		});
+	m_TileHitOffsets[0] = 0;
+	std::partial_sum(m_TileHitOffsets.begin(), m_TileHitOffsets.end(), m_TileHitOffsets.begin());
+	const uint32_t numHits{ m_TileHitOffsets[numTiles] };
+	m_HitSamples.resize(numHits);
+	m_pThreadPool->ParallelFor(numTiles, tilesPerTask, [&](uint32_t tileIndex)
+		{
+			uint32_t hitIdx{ m_TileHitOffsets[tileIndex] };
+			for (uint32_t rayIdx{}; rayIdx < m_PrimaryPackets[tileIndex].GetSize(); ++rayIdx)
+			{
+				const uint32_t primaryIdx{ tileIndex * RayPacket::maxSize + rayIdx };
+				if (m_PrimaryHits[primaryIdx].didHit)
+				{
+					m_HitSamples[hitIdx++] = primaryIdx;
+				}
+			}
+		});
+
+	//Emit and trace the shadow rays
+	if constexpr (shadowsEnabled)
+	{
+		m_ShadowRays.Resize(numHits * numLights);
+		m_ShadowOcclusion.resize(numHits * numLights);
+		m_pThreadPool->ParallelFor(numTiles, tilesPerTask, [&](uint32_t tileIndex)
+			{
+				for (uint32_t hitIdx{ m_TileHitOffsets[tileIndex] }; hitIdx < m_TileHitOffsets[tileIndex + 1]; ++hitIdx)
+				{
+					const HitRecord& closestHit{ m_PrimaryHits[m_HitSamples[hitIdx]] };
+					const Vector3 originOffset{ closestHit.origin + closestHit.normal * 0.0001f };
+					for (uint32_t lightIdx{}; lightIdx < numLights; ++lightIdx)
+					{
+						Vector3 lightDirection{ LightUtils::GetDirectionToLight(lights[lightIdx], originOffset) };
+						const float magnitude{ lightDirection.Normalize() };
+						m_ShadowRays.SetRay(hitIdx * numLights + lightIdx, originOffset, lightDirection, magnitude);
+					}
+				}
+			});
+		m_pThreadPool->ParallelFor(numTiles, tilesPerTask, [&](uint32_t tileIndex)
+			{
+				for (uint32_t shadowIdx{ m_TileHitOffsets[tileIndex] * numLights }; shadowIdx < m_TileHitOffsets[tileIndex + 1] * numLights; ++shadowIdx)
+				{
+					m_ShadowOcclusion[shadowIdx] = pScene->DoesHit(m_ShadowRays.GetRay(shadowIdx));
+				}
+			});
+	}
+
+	//Bin the hit samples per material (counting sort, chunks keep their pixel order) so every material evaluates its
+	//BRDF over contiguous batches, resolving the material type once per batch instead of once per sample and light
+	const uint32_t numMaterials{ static_cast<uint32_t>(materials.size()) };
+	const uint32_t numChunks{ (numHits + binChunkSize - 1) / binChunkSize };
+	m_ChunkMaterialOffsets.assign(numChunks * numMaterials, 0);
+	m_pThreadPool->ParallelFor(numChunks, 1, [&](uint32_t chunkIdx)
+		{
+			uint32_t* pCounts{ m_ChunkMaterialOffsets.data() + chunkIdx * numMaterials };
+			for (uint32_t hitIdx{ chunkIdx * binChunkSize }; hitIdx < std::min(numHits, (chunkIdx + 1) * binChunkSize); ++hitIdx)
+			{
+				++pCounts[m_PrimaryHits[m_HitSamples[hitIdx]].materialIndex];
+			}
+		});
+	m_MaterialOffsets.resize(numMaterials + 1);
+	m_ShadingBatches.clear();
+	uint32_t sampleOffset{};
+	for (uint32_t materialIdx{}; materialIdx < numMaterials; ++materialIdx)
+	{
+		m_MaterialOffsets[materialIdx] = sampleOffset;
+		for (uint32_t chunkIdx{}; chunkIdx < numChunks; ++chunkIdx)
+		{
+			uint32_t& offset{ m_ChunkMaterialOffsets[chunkIdx * numMaterials + materialIdx] };
+			const uint32_t count{ offset };
+			offset = sampleOffset;
+			sampleOffset += count;
+		}
+		for (uint32_t first{ m_MaterialOffsets[materialIdx] }; first < sampleOffset; first += ShadingBatch::maxSize)
+		{
+			m_ShadingBatches.push_back({ materialIdx, first, std::min(sampleOffset, first + ShadingBatch::maxSize) });
+		}
+	}
+	m_MaterialOffsets[numMaterials] = sampleOffset;
+	m_MaterialSamples.resize(numHits);
+	m_pThreadPool->ParallelFor(numChunks, 1, [&](uint32_t chunkIdx)
+		{
+			uint32_t* pOffsets{ m_ChunkMaterialOffsets.data() + chunkIdx * numMaterials };
+			for (uint32_t hitIdx{ chunkIdx * binChunkSize }; hitIdx < std::min(numHits, (chunkIdx + 1) * binChunkSize); ++hitIdx)
+			{
+				m_MaterialSamples[pOffsets[m_PrimaryHits[m_HitSamples[hitIdx]].materialIndex]++] = hitIdx;
+			}
+		});
+
+	//Shade every batch light by light, 4 samples at a time. The order of operations per sample is the same as in ShadePixel,
+	//occluded samples add nothing instead of skipping the light.
+	m_pThreadPool->ParallelFor(static_cast<uint32_t>(m_ShadingBatches.size()), 1, [&](uint32_t batchIdx)
+		{
+			const MaterialBatch& materialBatch{ m_ShadingBatches[batchIdx] };
+			const Material& material{ materials[materialBatch.materialIndex] };
+			ShadingBatch batch;
+			batch.count = materialBatch.last - materialBatch.first;
+			const uint32_t paddedCount{ batch.GetPaddedCount() };
+			alignas(16) float originX[ShadingBatch::maxSize];
+			alignas(16) float originY[ShadingBatch::maxSize];
+			alignas(16) float originZ[ShadingBatch::maxSize];
+			alignas(16) float offsetX[ShadingBatch::maxSize];
+			alignas(16) float offsetY[ShadingBatch::maxSize];
+			alignas(16) float offsetZ[ShadingBatch::maxSize];
+			alignas(16) float shadowFactors[ShadingBatch::maxSize];
+			alignas(16) uint32_t occludedMasks[ShadingBatch::maxSize];
+			ColorBatch brdfs;
+			ColorBatch colors;
+			colors.Fill(paddedCount, {});
+			std::fill(shadowFactors, shadowFactors + paddedCount, 1.f);
+
+			for (uint32_t sampleIdx{}; sampleIdx < paddedCount; ++sampleIdx)
+			{
+				//The padding lanes repeat the last sample, so every lane works on finite values
+				const uint32_t hitIdx{ m_MaterialSamples[materialBatch.first + std::min(sampleIdx, batch.count - 1)] };
+				const uint32_t primaryIdx{ m_HitSamples[hitIdx] };
+				const HitRecord& closestHit{ m_PrimaryHits[primaryIdx] };
+				const Vector3 viewDirection{ m_PrimaryPackets[primaryIdx / RayPacket::maxSize].GetDirection(primaryIdx % RayPacket::maxSize) };
+				batch.SetSample(sampleIdx, closestHit.normal, -viewDirection);
+				const Vector3 originOffset{ closestHit.origin + closestHit.normal * 0.0001f };
+				originX[sampleIdx] = closestHit.origin.x;
+				originY[sampleIdx] = closestHit.origin.y;
+				originZ[sampleIdx] = closestHit.origin.z;
+				offsetX[sampleIdx] = originOffset.x;
+				offsetY[sampleIdx] = originOffset.y;
+				offsetZ[sampleIdx] = originOffset.z;
+			}
 
+			const __m128 zero{ _mm_setzero_ps() };
+			for (uint32_t lightIdx{}; lightIdx < numLights; ++lightIdx)
+			{
+				const Light& light{ lights[lightIdx] };
+				const __m128 lightOriginX{ _mm_set1_ps(light.origin.x) };
+				const __m128 lightOriginY{ _mm_set1_ps(light.origin.y) };
+				const __m128 lightOriginZ{ _mm_set1_ps(light.origin.z) };
+
+				//Normalized direction from the offset origin to the light, see LightUtils::GetDirectionToLight
+				for (uint32_t sampleIdx{}; sampleIdx < paddedCount; sampleIdx += 4)
+				{
+					const __m128 directionX{ _mm_sub_ps(lightOriginX, _mm_load_ps(offsetX + sampleIdx)) };
+					const __m128 directionY{ _mm_sub_ps(lightOriginY, _mm_load_ps(offsetY + sampleIdx)) };
+					const __m128 directionZ{ _mm_sub_ps(lightOriginZ, _mm_load_ps(offsetZ + sampleIdx)) };
+					const __m128 magnitude{ _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, directionX), _mm_mul_ps(directionY, directionY)), _mm_mul_ps(directionZ, directionZ))) };
+					_mm_store_ps(batch.lightX + sampleIdx, _mm_div_ps(directionX, magnitude));
+					_mm_store_ps(batch.lightY + sampleIdx, _mm_div_ps(directionY, magnitude));
+					_mm_store_ps(batch.lightZ + sampleIdx, _mm_div_ps(directionZ, magnitude));
+				}
+				if constexpr (UsesBRDF(lightingMode))
+				{
+					material.Shade(batch, brdfs);
+				}
+
+				for (uint32_t sampleIdx{}; sampleIdx < paddedCount; ++sampleIdx)
+				{
+					bool isOccluded{};
+					if constexpr (shadowsEnabled)
+					{
+						isOccluded = sampleIdx < batch.count && m_ShadowOcclusion[m_MaterialSamples[materialBatch.first + sampleIdx] * numLights + lightIdx];
+					}
+					occludedMasks[sampleIdx] = isOccluded ? ~0u : 0u;
+				}
+
+				for (uint32_t sampleIdx{}; sampleIdx < paddedCount; sampleIdx += 4)
+				{
+					const __m128 isOccluded{ _mm_castsi128_ps(_mm_load_si128(reinterpret_cast<const __m128i*>(occludedMasks + sampleIdx))) };
+					const __m128 shadowFactor{ _mm_load_ps(shadowFactors + sampleIdx) };
+					_mm_store_ps(shadowFactors + sampleIdx, _mm_or_ps(_mm_and_ps(isOccluded, _mm_mul_ps(shadowFactor, _mm_set1_ps(0.95f))), _mm_andnot_ps(isOccluded, shadowFactor)));
+
+					//max(n.l, 0), the same for every color channel
+					const __m128 observedArea{ _mm_max_ps(zero, _mm_add_ps(_mm_add_ps(
+						_mm_mul_ps(_mm_load_ps(batch.normalX + sampleIdx), _mm_load_ps(batch.lightX + sampleIdx)),
+						_mm_mul_ps(_mm_load_ps(batch.normalY + sampleIdx), _mm_load_ps(batch.lightY + sampleIdx))),
+						_mm_mul_ps(_mm_load_ps(batch.normalZ + sampleIdx), _mm_load_ps(batch.lightZ + sampleIdx)))) };
+
+					//Radiance scale of the light at the hit origin, see LightUtils::GetRadiance
+					__m128 radianceScale{ _mm_set1_ps(light.intensity) };
+					if (light.type == LightType::Point)
+					{
+						const __m128 toLightX{ _mm_sub_ps(lightOriginX, _mm_load_ps(originX + sampleIdx)) };
+						const __m128 toLightY{ _mm_sub_ps(lightOriginY, _mm_load_ps(originY + sampleIdx)) };
+						const __m128 toLightZ{ _mm_sub_ps(lightOriginZ, _mm_load_ps(originZ + sampleIdx)) };
+						radianceScale = _mm_div_ps(radianceScale, _mm_add_ps(_mm_add_ps(_mm_mul_ps(toLightX, toLightX), _mm_mul_ps(toLightY, toLightY)), _mm_mul_ps(toLightZ, toLightZ)));
+					}
+					else if (light.type != LightType::Directional)
+					{
+						radianceScale = zero;
+					}
+
+					float* const pChannels[]{ colors.r + sampleIdx, colors.g + sampleIdx, colors.b + sampleIdx };
+					const float* const pBRDFChannels[]{ brdfs.r + sampleIdx, brdfs.g + sampleIdx, brdfs.b + sampleIdx };
+					const float lightChannels[]{ light.color.r, light.color.g, light.color.b };
+					for (int channel{}; channel < 3; ++channel)
+					{
+						__m128 contribution{};
+						if constexpr (lightingMode == LightingMode::Combined)
+						{
+							const __m128 radiance{ _mm_mul_ps(_mm_set1_ps(lightChannels[channel]), radianceScale) };
+							contribution = _mm_mul_ps(_mm_mul_ps(radiance, observedArea), _mm_load_ps(pBRDFChannels[channel]));
+						}
+						else if constexpr (lightingMode == LightingMode::ObservedArea)
+						{
+							contribution = observedArea;
+						}
+						else if constexpr (lightingMode == LightingMode::Radiance)
+						{
+							contribution = _mm_mul_ps(_mm_set1_ps(lightChannels[channel]), radianceScale);
+						}
+						else
+						{
+							contribution = _mm_load_ps(pBRDFChannels[channel]);
+						}
+						_mm_store_ps(pChannels[channel], _mm_add_ps(_mm_load_ps(pChannels[channel]), _mm_andnot_ps(isOccluded, contribution)));
+					}
+				}
+			}
+
+			for (uint32_t sampleIdx{}; sampleIdx < batch.count; ++sampleIdx)
+			{
+				int px{}, py{};
+				getPixel(m_HitSamples[m_MaterialSamples[materialBatch.first + sampleIdx]], px, py);
+				WritePixel(px, py, ColorRGB{ colors.r[sampleIdx], colors.g[sampleIdx], colors.b[sampleIdx] } * shadowFactors[sampleIdx]);
+			}
+		});
+}
+
+template<Renderer::LightingMode lightingMode, bool shadowsEnabled>
+void dae::Renderer::ShadePixel(Scene* pScene, int px, int py, const Vector3& viewDirection, const HitRecord& closestHit, const std::vector<Light>& lights, const std::vector<Material>& materials) const
+{
 	float shadowFactor{ 1.f };
 	ColorRGB finalColor{};
 
@@ -130,60 +475,132 @@ void dae::Renderer::RenderPixel(Scene* pScene, uint32_t pixelIndex, float aspect
 			Vector3 lightDirection{ LightUtils::GetDirectionToLight(light, originOffset) };
 			const float magnitude{ lightDirection.Normalize() };
 
-			if (m_ShadowsEnabled)
+			if constexpr (shadowsEnabled)
 			{
 				//Attempt to hit an object between the the hit origin and the light.
-				const Ray shadowRay{ originOffset, lightDirection, 0.0001f, magnitude };				
-				if (pScene->DoesHit(shadowRay)) 
+				if (pScene->DoesHit({ originOffset, lightDirection, 0.0001f, magnitude }))
 				{
 					shadowFactor *= 0.95f;
 					continue;
 				}
-			}			
-
-			//Calculate the color of the pixel based on the lighting mode
-			switch (m_CurrentLightingMode)
-			{
-			case LightingMode::Combined:
-			{
-				const float observedArea{ std::max(Vector3::Dot(closestHit.normal, lightDirection), 0.f) };
-				const ColorRGB radiance{ LightUtils::GetRadiance(light, closestHit.origin) };
-				const ColorRGB brdf{ materials[closestHit.materialIndex]->Shade(closestHit, lightDirection, -viewDirection) };
-				finalColor += observedArea * radiance * brdf;
-				break;
-			}
-			case LightingMode::ObservedArea:
-			{
-				const float observedArea{ std::max(Vector3::Dot(closestHit.normal, lightDirection), 0.f) };
-				finalColor += ColorRGB{ observedArea, observedArea, observedArea };
-				break;
 			}
-			case LightingMode::Radiance:
-			{
-				finalColor += LightUtils::GetRadiance(light, closestHit.origin);
-				break;
-			}
-			case LightingMode::BRDF:
+
+			const float observedArea{ std::max(Vector3::Dot(closestHit.normal, lightDirection), 0.f) };
+			ColorRGB brdf{};
+			if constexpr (UsesBRDF(lightingMode))
 			{
-				finalColor += materials[closestHit.materialIndex]->Shade(closestHit, lightDirection, -viewDirection);
-				break;
-			}
+				brdf = materials[closestHit.materialIndex].Shade(closestHit, lightDirection, -viewDirection);
 			}
+			finalColor += GetLightContribution<lightingMode>(light, closestHit.origin, observedArea, brdf);
 		}
 		finalColor *= shadowFactor;
 	}
+	WritePixel(px, py, finalColor);
+}
+
+template<Renderer::LightingMode lightingMode>
+ColorRGB dae::Renderer::GetLightContribution(const Light& light, const Vector3& origin, float observedArea, const ColorRGB& brdf)
+{
+	//Calculate the color of the pixel based on the lighting mode
+	if constexpr (lightingMode == LightingMode::Combined)
+	{
+		return observedArea * LightUtils::GetRadiance(light, origin) * brdf;
+	}
+	else if constexpr (lightingMode == LightingMode::ObservedArea)
+	{
+		return ColorRGB{ observedArea, observedArea, observedArea };
+	}
+	else if constexpr (lightingMode == LightingMode::Radiance)
+	{
+		return LightUtils::GetRadiance(light, origin);
+	}
+	else
+	{
+		return brdf;
+	}
+}
+
+void dae::Renderer::WritePixel(int px, int py, ColorRGB color) const
+{
 	//Update Color in Buffer
-	finalColor.MaxToOne();
+	color.MaxToOne();
 
-	m_pBufferPixels[px + (py * m_Width)] = SDL_MapRGB(m_pBuffer->format,
-		static_cast<uint8_t>(finalColor.r * 255),
-		static_cast<uint8_t>(finalColor.g * 255),
-		static_cast<uint8_t>(finalColor.b * 255));	
+	const int pixelIdx{ (px - m_Region.x) + (py - m_Region.y) * m_Target.rowPitch };
+	switch (m_Target.format)
+	{
+	case PixelFormat::RGBA8:
+		static_cast<uint32_t*>(m_Target.pPixels)[pixelIdx] =
+			static_cast<uint32_t>(static_cast<uint8_t>(color.r * 255)) |
+			static_cast<uint32_t>(static_cast<uint8_t>(color.g * 255)) << 8 |
+			static_cast<uint32_t>(static_cast<uint8_t>(color.b * 255)) << 16 |
+			0xFF000000u;
+		break;
+	case PixelFormat::BGRA8:
+		static_cast<uint32_t*>(m_Target.pPixels)[pixelIdx] =
+			static_cast<uint32_t>(static_cast<uint8_t>(color.b * 255)) |
+			static_cast<uint32_t>(static_cast<uint8_t>(color.g * 255)) << 8 |
+			static_cast<uint32_t>(static_cast<uint8_t>(color.r * 255)) << 16 |
+			0xFF000000u;
+		break;
+	case PixelFormat::RGBFloat:
+	{
+		float* pPixel{ static_cast<float*>(m_Target.pPixels) + pixelIdx * 3 };
+		pPixel[0] = color.r;
+		pPixel[1] = color.g;
+		pPixel[2] = color.b;
+		break;
+	}
+	}
+}
+
+void dae::Renderer::CycleRenderMode()
+{
+	m_CurrentRenderMode = static_cast<RenderMode>((static_cast<int>(m_CurrentRenderMode) + 1) %
+		static_cast<int>(RenderMode::Count));
+
+	std::cout << "Render mode: " << GetRenderModeName() << "\n";
+}
+
+const char* dae::Renderer::GetRenderModeName() const
+{
+	switch (m_CurrentRenderMode)
+	{
+	case RenderMode::SingleRay:
+		return "single rays";
+	case RenderMode::Packets:
+		return "8x8 ray packets";
+	case RenderMode::Wavefront:
+		return "wavefront";
+	default:
+		return "";
+	}
+}
+
+const char* dae::Renderer::GetLightingModeName() const
+{
+	switch (m_CurrentLightingMode)
+	{
+	case LightingMode::ObservedArea:
+		return "observed area";
+	case LightingMode::Radiance:
+		return "radiance";
+	case LightingMode::BRDF:
+		return "BRDF";
+	case LightingMode::Combined:
+		return "combined";
+	default:
+		return "";
+	}
+}
+
+void dae::Renderer::SetThreadCount(unsigned int threadCount)
+{
+	m_pThreadPool = std::make_unique<ThreadPool>(threadCount);
 }
 
-bool Renderer::SaveBufferToImage() const
+void dae::Renderer::SetFrameTileSize(int frameTileSize)
 {
-	return SDL_SaveBMP(m_pBuffer, "RayTracing_Buffer.bmp");
+	m_FrameTileSize = (std::max(frameTileSize, 1) + tileSize - 1) / tileSize * tileSize;
 }
 
 void dae::Renderer::CycleLightingMode()
@@ -2,9 +2,12 @@
 
 #include <cstdint>
 #include <iostream>
+#include <memory>
 #include <vector>
-struct SDL_Window;
-struct SDL_Surface;
+
+#include "DataTypes.h"
+#include "RayStatistics.h"
+#include "ThreadPool.h"
 
 namespace dae
 {
@@ -12,12 +15,36 @@ namespace dae
 	class Timer;
 	class Material;
 	struct Camera;
-	struct Light;
 
+	enum class PixelFormat
+	{
+		RGBA8, //uint32_t per pixel, bytes r, g, b, a in memory
+		BGRA8, //uint32_t per pixel, bytes b, g, r, a in memory (0xAARRGGBB, the XRGB8888 of most window surfaces)
+		RGBFloat //3 floats per pixel
+	};
+
+	//Caller owned pixels Render writes to, pPixels is the top left pixel of the rendered region
+	struct FrameBuffer
+	{
+		void* pPixels;
+		int rowPitch; //In pixels
+		PixelFormat format;
+	};
+
+	//Pixel rectangle of the image
+	struct Rect
+	{
+		int x;
+		int y;
+		int width;
+		int height;
+	};
+
+	//Traces images of width x height pixels, presenting them is up to the caller (see SDLPresenter)
 	class Renderer final
 	{
 	public:
-		Renderer(SDL_Window* pWindow);
+		Renderer(int width, int height);
 		~Renderer() = default;
 
 		Renderer(const Renderer&) = delete;
@@ -25,18 +52,34 @@ namespace dae
 		Renderer& operator=(const Renderer&) = delete;
 		Renderer& operator=(Renderer&&) noexcept = delete;
 
-		void Render(Scene* pScene) const;
-		void RenderPixel(Scene* pScene, uint32_t pixelIndex, float aspectRatio, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material*>& materials) const;
+		//Renders the whole image
+		bool Render(Scene* pScene, const FrameBuffer& target);
+		//Renders the pixels of the region only. Returns false without writing anything if the region doesn't lie
+		//inside the image or the target has no pixels or a row pitch narrower than the region.
+		bool Render(Scene* pScene, const FrameBuffer& target, const Rect& region);
 
-		bool SaveBufferToImage() const;
+		int GetWidth() const { return m_Width; }
+		int GetHeight() const { return m_Height; }
 
 		void CycleLightingMode();
 		void ToggleShadows() { 
 			m_ShadowsEnabled = !m_ShadowsEnabled; 
 		}
+		bool AreShadowsEnabled() const { return m_ShadowsEnabled; }
+		void CycleRenderMode();
+		const char* GetRenderModeName() const;
+		const char* GetLightingModeName() const;
 
-	private:
+		//0 uses one thread per hardware thread
+		void SetThreadCount(unsigned int threadCount);
+		unsigned int GetThreadCount() const { return m_pThreadPool->GetThreadCount(); }
+		//Rounded up to a multiple of the packet tile size
+		void SetFrameTileSize(int frameTileSize);
+		int GetFrameTileSize() const { return m_FrameTileSize; }
+		//Work done by the rays of the last Render call, all zero unless RAY_STATISTICS is defined
+		const RayStatistics::Counts& GetRayCounts() const { return m_RayCounts; }
 
+	private:
 		enum class LightingMode
 		{
 			ObservedArea,
@@ -46,18 +89,88 @@ namespace dae
 			//Define modes above
 			Count
 		};
+
+		//The per pixel kernels are instantiated per lighting mode and shadow toggle,
+		//Render picks the RenderFrame instantiation once so nothing below it branches on either
+		template<LightingMode lightingMode, bool shadowsEnabled>
+		void RenderFrame(Scene* pScene);
+		template<LightingMode lightingMode, bool shadowsEnabled>
+		void RenderPixel(Scene* pScene, int px, int py, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material>& materials) const;
+		template<LightingMode lightingMode, bool shadowsEnabled>
+		void RenderTile(Scene* pScene, uint32_t tileIndex, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material>& materials) const;
+		template<LightingMode lightingMode, bool shadowsEnabled>
+		void RenderWavefront(Scene* pScene, const Camera& camera, const std::vector<Light>& lights, const std::vector<Material>& materials);
+		template<LightingMode lightingMode, bool shadowsEnabled>
+		void ShadePixel(Scene* pScene, int px, int py, const Vector3& viewDirection, const HitRecord& closestHit, const std::vector<Light>& lights, const std::vector<Material>& materials) const;
+		//Contribution of a single unoccluded light, the brdf is only read by the modes that need it
+		template<LightingMode lightingMode>
+		static ColorRGB GetLightContribution(const Light& light, const Vector3& origin, float observedArea, const ColorRGB& brdf);
+		static constexpr bool UsesBRDF(LightingMode lightingMode)
+		{
+			return lightingMode == LightingMode::Combined || lightingMode == LightingMode::BRDF;
+		}
+
+		//Packet tiles cover the region being rendered, the ones along its right and bottom edge can be smaller
+		int GetNumTilesX() const { return (m_Region.width + tileSize - 1) / tileSize; }
+		void GetTileOrigin(uint32_t tileIndex, int& firstX, int& firstY) const;
+		void GeneratePrimaryPacket(uint32_t tileIndex, const Camera& camera, RayPacket& packet) const;
+		void WritePixel(int px, int py, ColorRGB color) const;
+
 		LightingMode m_CurrentLightingMode{ LightingMode::Combined };
 		bool m_ShadowsEnabled{ true };
+
+		//SingleRay and Packets run every stage for a pixel (or a tile of tileSize x tileSize pixels) before moving on,
+		//Wavefront runs each stage for the whole frame before starting the next one
+		enum class RenderMode
+		{
+			SingleRay,
+			Packets,
+			Wavefront,
+			//Define modes above
+			Count
+		};
+		//Packets by default, F9 cycles to SingleRay to compare against
+		RenderMode m_CurrentRenderMode{ RenderMode::Packets };
+		static constexpr int tileSize{ RayPacket::maxWidth };
+		//SingleRay and Packets split the frame into square frame tiles of m_FrameTileSize pixels, one pool task each.
+		//The wavefront stages give every task as many packet tiles as a frame tile holds.
+		int m_FrameTileSize{ 32 };
+		std::unique_ptr<ThreadPool> m_pThreadPool{ std::make_unique<ThreadPool>() };
 		bool m_F3Pressed{ false };
 		bool m_F2Pressed{ false };
 
-		SDL_Window* m_pWindow{};
-
-		SDL_Surface* m_pBuffer{};
-		uint32_t* m_pBufferPixels{};
-
 		int m_Width{};
 		int m_Height{};
 		float m_AspectRatio{ };
+
+		//Target and region of the Render call in progress
+		FrameBuffer m_Target{};
+		Rect m_Region{};
+		RayStatistics::Counts m_RayCounts{};
+
+		//Wavefront buffers, kept between frames so they are only allocated once.
+		//Primary hits are stored per tile, RayPacket::maxSize slots each.
+		std::vector<RayPacket> m_PrimaryPackets{};
+		std::vector<HitRecord> m_PrimaryHits{};
+		//Primary hit index of every primary ray that hit something, m_TileHitOffsets[tile] is where the hits of a tile start
+		std::vector<uint32_t> m_HitSamples{};
+		std::vector<uint32_t> m_TileHitOffsets{};
+		//A shadow ray and its result per hit sample per light
+		RayStream m_ShadowRays{};
+		std::vector<uint8_t> m_ShadowOcclusion{};
+		//Hit samples sorted per material, m_MaterialOffsets[material] is where the samples of a material start.
+		//The counting sort runs over chunks of binChunkSize hit samples, each with its own offset per material
+		static constexpr uint32_t binChunkSize{ 4096 };
+		std::vector<uint32_t> m_ChunkMaterialOffsets{};
+		std::vector<uint32_t> m_MaterialOffsets{};
+		std::vector<uint32_t> m_MaterialSamples{};
+		//Range [first, last) of m_MaterialSamples shaded with a single call to the material
+		struct MaterialBatch
+		{
+			uint32_t materialIndex;
+			uint32_t first;
+			uint32_t last;
+		};
+		std::vector<MaterialBatch> m_ShadingBatches{};
 	};
 }
@@ -0,0 +1,59 @@
+//External includes
+#include "SDL.h"
+#include "SDL_surface.h"
+
+//Project includes
+#include "SDLPresenter.h"
+#include "Renderer.h"
+
+#include <cassert>
+
+using namespace dae;
+
+SDLPresenter::SDLPresenter(SDL_Window* pWindow) :
+	m_pWindow(pWindow),
+	m_pSurface(SDL_GetWindowSurface(pWindow))
+{
+	//The alpha (or padding) byte is written as 0xFF either way. The packed X formats are named by their value, on x86
+	//(little endian) RGB888 (XRGB8888, what windows usually get) has the bytes b, g, r, x in memory.
+	switch (m_pSurface->format->format)
+	{
+	case SDL_PIXELFORMAT_RGBA32:
+	case SDL_PIXELFORMAT_BGR888:
+		m_PixelFormat = PixelFormat::RGBA8;
+		break;
+	case SDL_PIXELFORMAT_BGRA32:
+	case SDL_PIXELFORMAT_RGB888:
+		m_PixelFormat = PixelFormat::BGRA8;
+		break;
+	default:
+		m_PixelFormat = PixelFormat::RGBA8;
+		m_StagingPixels.resize(static_cast<size_t>(m_pSurface->w) * m_pSurface->h);
+		break;
+	}
+}
+
+void SDLPresenter::Render(Renderer& renderer, Scene* pScene)
+{
+	assert(renderer.GetWidth() == m_pSurface->w && renderer.GetHeight() == m_pSurface->h);
+
+	if (m_StagingPixels.empty())
+	{
+		renderer.Render(pScene, { m_pSurface->pixels, m_pSurface->pitch / 4, m_PixelFormat });
+	}
+	else
+	{
+		renderer.Render(pScene, { m_StagingPixels.data(), m_pSurface->w, PixelFormat::RGBA8 });
+		SDL_ConvertPixels(m_pSurface->w, m_pSurface->h, SDL_PIXELFORMAT_RGBA32, m_StagingPixels.data(), m_pSurface->w * 4,
+			m_pSurface->format->format, m_pSurface->pixels, m_pSurface->pitch);
+	}
+
+	//@END
+	//Update SDL Surface
+	SDL_UpdateWindowSurface(m_pWindow);
+}
+
+bool SDLPresenter::SaveBufferToImage() const
+{
+	return SDL_SaveBMP(m_pSurface, "RayTracing_Buffer.bmp") == 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+//Standard includes
+#include <cstdint>
+#include <vector>
+
+struct SDL_Window;
+struct SDL_Surface;
+
+namespace dae
+{
+	class Renderer;
+	class Scene;
+	enum class PixelFormat;
+
+	//Shows the images of a Renderer in an SDL window. Renders straight into the window surface when it is 32 bit RGB
+	//or BGR (RGBA8 or BGRA8, XRGB8888 being the usual one), otherwise into a staging buffer that is converted to the format of the surface.
+	class SDLPresenter final
+	{
+	public:
+		SDLPresenter(SDL_Window* pWindow);
+		~SDLPresenter() = default;
+
+		SDLPresenter(const SDLPresenter&) = delete;
+		SDLPresenter(SDLPresenter&&) noexcept = delete;
+		SDLPresenter& operator=(const SDLPresenter&) = delete;
+		SDLPresenter& operator=(SDLPresenter&&) noexcept = delete;
+
+		//The renderer has to be as large as the window
+		void Render(Renderer& renderer, Scene* pScene);
+
+		//Saves the last presented image as RayTracing_Buffer.bmp, returns true when it was saved
+		bool SaveBufferToImage() const;
+
+	private:
+		SDL_Window* m_pWindow{};
+		SDL_Surface* m_pSurface{};
+		//Format the renderer writes in, into the surface itself when the staging buffer is empty
+		PixelFormat m_PixelFormat{};
+		std::vector<uint32_t> m_StagingPixels{};
+	};
+}
@@ -1,13 +1,21 @@
 #include "Scene.h"
 #include "Utils.h"
 #include "Material.h"
+#include "PerfCounters.h"
+#include "RayStatistics.h"
+#include "Timer.h"
+
+#include <cassert>
+#include <cfloat>
+#include <chrono>
+#include <thread>
 
 namespace dae {
 
 #pragma region Base Scene
 	//Initialize Scene with Default Solid Color Material (RED)
 	Scene::Scene() :
-		m_Materials({ new Material_SolidColor({1,0,0}) })
+		m_Materials({ Material_SolidColor({1,0,0}) })
 	{
 		m_SphereGeometries.reserve(32);
 		m_PlaneGeometries.reserve(32);
@@ -15,20 +23,68 @@ namespace dae {
 		m_Lights.reserve(32);
 	}
 
-	Scene::~Scene()
+	Scene::~Scene() = default;
+
+	template<bool profileNodes>
+	void Scene::FindClosestHit(const Ray& ray, HitRecord& closestHit, std::vector<unsigned int>* pNodeVisits) const
 	{
-		for (auto& pMaterial : m_Materials)
+		HitRecord hitRecord{};
+		for (const auto& plane : m_PlaneGeometries)
 		{
-			delete pMaterial;
-			pMaterial = nullptr;
+			if (GeometryUtils::HitTest_Plane(plane, ray, hitRecord))
+			{
+				if (hitRecord.t < closestHit.t)
+				{
+					closestHit = hitRecord;
+				}
+			}
 		}
 
-		m_Materials.clear();
-	}
+#ifdef USE_TLAS
+		if (m_TLAS.nodesUsed == 0) return;
 
-	void dae::Scene::GetClosestHit(const Ray& ray, HitRecord& closestHit) const
-	{
-		HitRecord hitRecord{};
+		const unsigned int sphereCount{ static_cast<unsigned int>(m_SphereGeometries.size()) };
+		unsigned int nodeStack[maxBVHDepth];
+		int stackSize{};
+		nodeStack[stackSize++] = 0;
+		while (stackSize > 0)
+		{
+			const TLASNode& node{ m_TLAS.nodes[nodeStack[--stackSize]] };
+			//Skip nodes that are entered beyond the closest hit so far
+			if (GeometryUtils::SlabTest_BVH(node.minAABB, node.maxAABB, ray, std::min(ray.max, closestHit.t)) == FLT_MAX) continue;
+			RayStatistics::Add(RayStatistics::Counter::BVHNodes);
+
+			if (!node.IsLeaf())
+			{
+				assert(stackSize + 2 <= static_cast<int>(maxBVHDepth));
+				nodeStack[stackSize++] = node.leftNode;
+				nodeStack[stackSize++] = node.leftNode + 1;
+				continue;
+			}
+
+			for (unsigned int idx{ node.firstIdx }; idx < node.firstIdx + node.idxCount; ++idx)
+			{
+				const unsigned int instanceIdx{ m_TLAS.instanceIndices[idx] };
+				if (instanceIdx < sphereCount)
+				{
+					if (GeometryUtils::HitTest_Sphere(m_SphereGeometries[instanceIdx], ray, hitRecord))
+					{
+						if (hitRecord.t < closestHit.t)
+						{
+							closestHit = hitRecord;
+							closestHit.normal.Normalize();
+						}
+					}
+				}
+				else
+				{
+					//Only overwrites closestHit with a closer hit, and culls the mesh against it
+					const unsigned int meshIdx{ instanceIdx - sphereCount };
+					GeometryUtils::HitTest_TriangleMesh<GeometryUtils::HitQuery::ClosestHit, profileNodes>(m_TriangleMeshGeometries[meshIdx], ray, closestHit, profileNodes ? pNodeVisits[meshIdx].data() : nullptr);
+				}
+			}
+		}
+#else
 		for (const auto& sphere : m_SphereGeometries)
 		{
 			
@@ -42,31 +98,122 @@ namespace dae {
 			}
 		}		
 
+		for (unsigned int meshIdx{}; meshIdx < m_TriangleMeshGeometries.size(); ++meshIdx)
+		{
+			GeometryUtils::HitTest_TriangleMesh<GeometryUtils::HitQuery::ClosestHit, profileNodes>(m_TriangleMeshGeometries[meshIdx], ray, closestHit, profileNodes ? pNodeVisits[meshIdx].data() : nullptr);
+		}
+#endif
+	}
+
+	//Packet version of GetClosestHit, pClosestHits holds a hitrecord per ray of the packet.
+	//TLAS nodes and the instances in their leaves are culled against the frustum of the packet.
+	void Scene::GetClosestHit(const RayPacket& packet, HitRecord* pClosestHits) const
+	{
 		for (const auto& plane : m_PlaneGeometries)
 		{
-			if (GeometryUtils::HitTest_Plane(plane, ray, hitRecord))
+			GeometryUtils::HitTest_Plane(plane, packet, pClosestHits);
+		}
+
+#ifdef USE_TLAS
+		if (m_TLAS.nodesUsed == 0) return;
+
+		const unsigned int sphereCount{ static_cast<unsigned int>(m_SphereGeometries.size()) };
+		unsigned int nodeStack[maxBVHDepth];
+		int stackSize{};
+		nodeStack[stackSize++] = 0;
+		while (stackSize > 0)
+		{
+			const TLASNode& node{ m_TLAS.nodes[nodeStack[--stackSize]] };
+			if (!GeometryUtils::FrustumTest_AABB(packet, node.minAABB, node.maxAABB)) continue;
+			RayStatistics::Add(RayStatistics::Counter::BVHNodes);
+
+			if (!node.IsLeaf())
 			{
-				if (hitRecord.t < closestHit.t)
+				assert(stackSize + 2 <= static_cast<int>(maxBVHDepth));
+				nodeStack[stackSize++] = node.leftNode;
+				nodeStack[stackSize++] = node.leftNode + 1;
+				continue;
+			}
+
+			for (unsigned int idx{ node.firstIdx }; idx < node.firstIdx + node.idxCount; ++idx)
+			{
+				const unsigned int instanceIdx{ m_TLAS.instanceIndices[idx] };
+				const AABB& instanceBounds{ m_InstanceBounds[instanceIdx] };
+				if (!GeometryUtils::FrustumTest_AABB(packet, instanceBounds.minAABB, instanceBounds.maxAABB)) continue;
+
+				if (instanceIdx < sphereCount)
 				{
-					closestHit = hitRecord;
+					GeometryUtils::HitTest_Sphere(m_SphereGeometries[instanceIdx], packet, pClosestHits);
+				}
+				else
+				{
+					GeometryUtils::HitTest_TriangleMesh(m_TriangleMeshGeometries[instanceIdx - sphereCount], packet, pClosestHits);
 				}
 			}
 		}
+#else
+		for (const auto& sphere : m_SphereGeometries)
+		{
+			GeometryUtils::HitTest_Sphere(sphere, packet, pClosestHits);
+		}
 
 		for (const auto& mesh : m_TriangleMeshGeometries)
 		{
-			if (GeometryUtils::HitTest_TriangleMesh(mesh, ray, hitRecord))
+			GeometryUtils::HitTest_TriangleMesh(mesh, packet, pClosestHits);
+		}
+#endif
+	}
+
+	template<bool profileNodes>
+	bool Scene::FindAnyHit(const Ray& ray, std::vector<unsigned int>* pNodeVisits) const
+	{
+		RayStatistics::Add(RayStatistics::Counter::ShadowRays);
+
+		for (const auto& plane : m_PlaneGeometries)
+		{
+			if (GeometryUtils::HitTest_Plane(plane, ray))
 			{
-				if (hitRecord.t < closestHit.t)
+				return true;
+			}
+		}
+
+#ifdef USE_TLAS
+		if (m_TLAS.nodesUsed == 0) return false;
+
+		const unsigned int sphereCount{ static_cast<unsigned int>(m_SphereGeometries.size()) };
+		unsigned int nodeStack[maxBVHDepth];
+		int stackSize{};
+		nodeStack[stackSize++] = 0;
+		while (stackSize > 0)
+		{
+			const TLASNode& node{ m_TLAS.nodes[nodeStack[--stackSize]] };
+			if (GeometryUtils::SlabTest_BVH(node.minAABB, node.maxAABB, ray, ray.max) == FLT_MAX) continue;
+			RayStatistics::Add(RayStatistics::Counter::BVHNodes);
+
+			if (!node.IsLeaf())
+			{
+				assert(stackSize + 2 <= static_cast<int>(maxBVHDepth));
+				nodeStack[stackSize++] = node.leftNode;
+				nodeStack[stackSize++] = node.leftNode + 1;
+				continue;
+			}
+
+			for (unsigned int idx{ node.firstIdx }; idx < node.firstIdx + node.idxCount; ++idx)
+			{
+				const unsigned int instanceIdx{ m_TLAS.instanceIndices[idx] };
+				if (instanceIdx < sphereCount)
 				{
-					closestHit = hitRecord;
+					if (GeometryUtils::HitTest_Sphere(m_SphereGeometries[instanceIdx], ray)) return true;
+				}
+				else
+				{
+					const unsigned int meshIdx{ instanceIdx - sphereCount };
+					HitRecord temp{};
+					if (GeometryUtils::HitTest_TriangleMesh<GeometryUtils::HitQuery::AnyHit, profileNodes>(m_TriangleMeshGeometries[meshIdx], ray, temp, profileNodes ? pNodeVisits[meshIdx].data() : nullptr)) return true;
 				}
 			}
 		}
-	}
-
-	bool Scene::DoesHit(const Ray& ray) const
-	{
+#else
 		for (const auto& sphere : m_SphereGeometries)
 		{			
 			if (GeometryUtils::HitTest_Sphere(sphere, ray))
@@ -75,24 +222,442 @@ namespace dae {
 			}
 		}
 
-		for (const auto& plane : m_PlaneGeometries)
+		for (unsigned int meshIdx{}; meshIdx < m_TriangleMeshGeometries.size(); ++meshIdx)
 		{
-			if (GeometryUtils::HitTest_Plane(plane, ray))
+			HitRecord temp{};
+			if (GeometryUtils::HitTest_TriangleMesh<GeometryUtils::HitQuery::AnyHit, profileNodes>(m_TriangleMeshGeometries[meshIdx], ray, temp, profileNodes ? pNodeVisits[meshIdx].data() : nullptr))
 			{
 				return true;
 			}
 		}
-		
+#endif
+
+		return false;
+	}
+
+	void Scene::GetClosestHit(const Ray& ray, HitRecord& closestHit) const
+	{
+		FindClosestHit<false>(ray, closestHit);
+	}
+
+	bool Scene::DoesHit(const Ray& ray) const
+	{
+		return FindAnyHit<false>(ray);
+	}
+
+	void Scene::CycleBVHLayout()
+	{
+		if (m_TriangleMeshGeometries.empty()) return;
+
+		const BVHLayout layout{ static_cast<BVHLayout>((static_cast<int>(m_TriangleMeshGeometries[0].bvhLayout) + 1) %
+			static_cast<int>(BVHLayout::Count)) };
+		for (auto& mesh : m_TriangleMeshGeometries)
+		{
+			mesh.bvhLayout = layout;
+		}
 
+		switch (layout)
+		{
+		case BVHLayout::Binary:
+			std::cout << "BVH Layout: Binary\n";
+			break;
+		case BVHLayout::Wide4:
+			std::cout << "BVH Layout: BVH4 (SSE)\n";
+			break;
+		case BVHLayout::Wide8:
+			//Without AVX the eight children are slab tested in two SSE passes
+#ifdef __AVX__
+			std::cout << "BVH Layout: BVH8 (AVX)\n";
+#else
+			std::cout << "BVH Layout: BVH8 (2x SSE)\n";
+#endif
+			break;
+		default:
+			break;
+		}
+	}
+
+	void Scene::PrintBVHStatistics() const
+	{
 		for (const auto& mesh : m_TriangleMeshGeometries)
 		{
-			if (GeometryUtils::HitTest_TriangleMesh(mesh, ray))
+			std::cout << "Mesh BVH >> triangles: " << mesh.indices.size() / 3
+				<< " | nodes: " << mesh.bvhNodes.size() << " | depth: " << mesh.bvhDepth
+				<< " | bytes/triangle: binary " << mesh.GetBVHBytesPerTriangle(BVHLayout::Binary)
+				<< ", BVH4 " << mesh.GetBVHBytesPerTriangle(BVHLayout::Wide4)
+				<< ", BVH8 " << mesh.GetBVHBytesPerTriangle(BVHLayout::Wide8)
+				<< " | SAH cost: " << mesh.bvhBuildCost;
+			if (mesh.optimizationTimeBudget > 0.f)
 			{
-				return true;
+				std::cout << " (" << mesh.bvhUnoptimizedCost << " before " << mesh.bvhOptimizationTime << " ms of rotations)";
 			}
+			std::cout << std::endl;
 		}
+	}
 
-		return false;
+	const char* Scene::GetBVHBuilderName(BVHBuilder builder)
+	{
+		switch (builder)
+		{
+		case BVHBuilder::LBVH:
+			return "LBVH";
+		case BVHBuilder::SpatialSAH:
+			return "SBVH";
+		default:
+			return "binned SAH";
+		}
+	}
+
+	void Scene::BenchmarkBVHBuild()
+	{
+		if (m_TriangleMeshGeometries.empty()) return;
+
+		std::vector<BVHBuilder> meshBuilders{};
+		for (const auto& mesh : m_TriangleMeshGeometries)
+		{
+			meshBuilders.push_back(mesh.bvhBuilder);
+		}
+
+		//Rebuild every mesh with each builder and 1, 2, 4, ... threads up to the hardware concurrency, best of a few runs.
+		//The SAH cost of the resulting trees is the traversal cost the build time buys.
+		const unsigned int maxThreadCount{ std::max(std::thread::hardware_concurrency(), 1u) };
+		const int amountOfRuns{ 5 };
+		for (const BVHBuilder builder : { BVHBuilder::BinnedSAH, BVHBuilder::LBVH, BVHBuilder::SpatialSAH })
+		{
+			//The spatial split builder is single threaded
+			const unsigned int builderMaxThreadCount{ builder == BVHBuilder::SpatialSAH ? 1u : maxThreadCount };
+			for (unsigned int threadCount{ 1 }; ; threadCount = std::min(threadCount * 2, builderMaxThreadCount))
+			{
+				double bestTime{ DBL_MAX };
+				for (int run{}; run < amountOfRuns; ++run)
+				{
+					const auto start{ std::chrono::high_resolution_clock::now() };
+					for (auto& mesh : m_TriangleMeshGeometries)
+					{
+						mesh.bvhBuilder = builder;
+						mesh.BuildBVH(threadCount);
+					}
+					const auto end{ std::chrono::high_resolution_clock::now() };
+					bestTime = std::min(bestTime, std::chrono::duration<double, std::milli>(end - start).count());
+				}
+				float sahCost{};
+				for (const auto& mesh : m_TriangleMeshGeometries)
+				{
+					sahCost += mesh.CalculateSAHCost();
+				}
+
+				std::cout << "BVH build >> " << GetBVHBuilderName(builder) << " | threads: " << threadCount
+					<< " | ms: " << bestTime << " | SAH cost: " << sahCost << std::endl;
+				if (threadCount == builderMaxThreadCount) break;
+			}
+		}
+
+		//Restore the trees each mesh was configured for
+		for (size_t meshIdx{}; meshIdx < m_TriangleMeshGeometries.size(); ++meshIdx)
+		{
+			m_TriangleMeshGeometries[meshIdx].bvhBuilder = meshBuilders[meshIdx];
+			m_TriangleMeshGeometries[meshIdx].BuildBVH();
+		}
+	}
+
+	void Scene::BenchmarkTriangleTests() const
+	{
+		if (m_TriangleMeshGeometries.empty()) return;
+
+		//Rays from the camera towards the triangle centers, each one tested against a window of (up to windowSize) neighbouring triangles.
+		//Run time: the cull mode and query are read for every test, as the kernels did before they were specialized.
+		const unsigned int maxRayCount{ 4096 };
+		const unsigned int windowSize{ 64 };
+		const int amountOfRuns{ 5 };
+		for (const GeometryUtils::HitQuery query : { GeometryUtils::HitQuery::ClosestHit, GeometryUtils::HitQuery::AnyHit })
+		{
+			double bestTimes[2]{ DBL_MAX, DBL_MAX };
+			uint64_t testCount{};
+			uint64_t hitCounts[2]{};
+			for (int run{}; run < amountOfRuns; ++run)
+			{
+				for (int specialized{}; specialized < 2; ++specialized)
+				{
+					testCount = 0;
+					hitCounts[specialized] = 0;
+					const auto start{ std::chrono::high_resolution_clock::now() };
+					for (const TriangleMesh& mesh : m_TriangleMeshGeometries)
+					{
+						const std::vector<BakedTriangle>& triangles{ mesh.bakedTriangles };
+						const unsigned int meshWindowSize{ static_cast<unsigned int>(std::min<size_t>(windowSize, triangles.size())) };
+
+						const Vector3 origin{ mesh.inverseTransform.TransformPoint(m_Camera.origin) };
+						const size_t rayStep{ std::max<size_t>(triangles.size() / maxRayCount, 1) };
+						for (size_t targetIdx{}; targetIdx + meshWindowSize <= triangles.size(); targetIdx += rayStep)
+						{
+							const BakedTriangle& target{ triangles[targetIdx] };
+							const Vector3 center{ target.v0 + (target.edge1 + target.edge2) / 3.f };
+							const Ray ray{ origin, (center - origin).Normalized() };
+							HitRecord hitRecord{};
+							const BakedTriangle* pTriangle{ triangles.data() + targetIdx };
+							if (specialized)
+							{
+								//The kernel is picked once per window
+								const auto testWindow{ [&](auto windowQuery, auto cullMode)
+									{
+										for (unsigned int triangleIdx{}; triangleIdx < meshWindowSize; ++triangleIdx)
+										{
+											hitCounts[specialized] += GeometryUtils::HitTest_Triangle<decltype(windowQuery)::value, decltype(cullMode)::value>(
+												pTriangle[triangleIdx], mesh.materialIndex, ray, hitRecord);
+										}
+									} };
+								GeometryUtils::DispatchCullMode(mesh.cullMode, [&](auto cullMode)
+									{
+										if (query == GeometryUtils::HitQuery::AnyHit)
+										{
+											testWindow(std::integral_constant<GeometryUtils::HitQuery, GeometryUtils::HitQuery::AnyHit>{}, cullMode);
+										}
+										else
+										{
+											testWindow(std::integral_constant<GeometryUtils::HitQuery, GeometryUtils::HitQuery::ClosestHit>{}, cullMode);
+										}
+									});
+							}
+							else
+							{
+								volatile TriangleCullMode cullMode{ mesh.cullMode };
+								volatile GeometryUtils::HitQuery testQuery{ query };
+								for (unsigned int triangleIdx{}; triangleIdx < meshWindowSize; ++triangleIdx)
+								{
+									const bool didHit{ testQuery == GeometryUtils::HitQuery::AnyHit ?
+										GeometryUtils::HitTest_Triangle<GeometryUtils::HitQuery::AnyHit>(pTriangle[triangleIdx], cullMode, mesh.materialIndex, ray, hitRecord) :
+										GeometryUtils::HitTest_Triangle<GeometryUtils::HitQuery::ClosestHit>(pTriangle[triangleIdx], cullMode, mesh.materialIndex, ray, hitRecord) };
+									hitCounts[specialized] += didHit;
+								}
+							}
+							testCount += meshWindowSize;
+						}
+					}
+					const auto end{ std::chrono::high_resolution_clock::now() };
+					bestTimes[specialized] = std::min(bestTimes[specialized], std::chrono::duration<double, std::nano>(end - start).count());
+				}
+			}
+			if (testCount == 0) return;
+
+			const double runTimeNs{ bestTimes[0] / testCount };
+			const double specializedNs{ bestTimes[1] / testCount };
+			std::cout << "Triangle test >> " << (query == GeometryUtils::HitQuery::AnyHit ? "any hit" : "closest hit") << " | tests: " << testCount
+				<< " | hits: " << hitCounts[1] << " | ns/test run time: " << runTimeNs << " | ns/test specialized: " << specializedNs
+				<< " | speedup: " << runTimeNs / specializedNs << "x" << std::endl;
+		}
+	}
+
+	const char* Scene::GetBVHNodeOrderName(BVHNodeOrder order)
+	{
+		switch (order)
+		{
+		case BVHNodeOrder::VanEmdeBoas:
+			return "van Emde Boas";
+		case BVHNodeOrder::AccessFrequency:
+			return "access frequency";
+		default:
+			return "creation";
+		}
+	}
+
+	//Lays out the binary BVH nodes of every mesh by how often a sample render of the current view visits them
+	void Scene::OptimizeBVHLayout(uint32_t width, uint32_t height)
+	{
+		if (m_TriangleMeshGeometries.empty()) return;
+
+		const auto start{ std::chrono::high_resolution_clock::now() };
+		ProfileBVHNodes(width, height);
+		const auto end{ std::chrono::high_resolution_clock::now() };
+		std::cout << "BVH node order >> access frequency | ms: " << std::chrono::duration<double, std::milli>(end - start).count() << std::endl;
+	}
+
+	//Counts the node visits of the binary BVHs while tracing every 4th pixel in both directions and lays the nodes out by them
+	void Scene::ProfileBVHNodes(uint32_t width, uint32_t height)
+	{
+		std::vector<std::vector<unsigned int>> nodeVisits{};
+		for (const auto& mesh : m_TriangleMeshGeometries)
+		{
+			nodeVisits.emplace_back(mesh.bvhNodes.size(), 0);
+		}
+
+		m_Camera.CalculateCameraToWorld();
+		TraceSampleRays<true>(width, height, 4, true, nodeVisits.data());
+
+		for (size_t meshIdx{}; meshIdx < m_TriangleMeshGeometries.size(); ++meshIdx)
+		{
+			m_TriangleMeshGeometries[meshIdx].ReorderBVHNodesByProfile(nodeVisits[meshIdx]);
+		}
+	}
+
+	//Renders the current view into nothing on the calling thread: a primary ray per traced pixel and a shadow ray per light
+	//for every hit. Without traceShadowRays the shadow rays are only counted.
+	template<bool profileNodes>
+	Scene::SampleRayCounts Scene::TraceSampleRays(uint32_t width, uint32_t height, uint32_t pixelStep, bool traceShadowRays, std::vector<unsigned int>* pNodeVisits) const
+	{
+		const float aspectRatio{ width / static_cast<float>(height) };
+		SampleRayCounts rayCounts{};
+		for (uint32_t py{}; py < height; py += pixelStep)
+		{
+			for (uint32_t px{}; px < width; px += pixelStep)
+			{
+				const Vector3 viewDirection{ m_Camera.GetPrimaryRayDirection(px, py, width, height, aspectRatio) };
+
+				HitRecord closestHit{};
+				FindClosestHit<profileNodes>({ m_Camera.origin, viewDirection }, closestHit, pNodeVisits);
+				++rayCounts.primaryRays;
+				if (!closestHit.didHit) continue;
+
+				rayCounts.shadowRays += m_Lights.size();
+				if (!traceShadowRays) continue;
+
+				const Vector3 originOffset{ closestHit.origin + closestHit.normal * 0.0001f };
+				for (const auto& light : m_Lights)
+				{
+					Vector3 lightDirection{ LightUtils::GetDirectionToLight(light, originOffset) };
+					const float magnitude{ lightDirection.Normalize() };
+					FindAnyHit<profileNodes>({ originOffset, lightDirection, 0.0001f, magnitude }, pNodeVisits);
+				}
+			}
+		}
+		return rayCounts;
+	}
+
+	void Scene::BenchmarkBVHLayout(uint32_t width, uint32_t height)
+	{
+		if (m_TriangleMeshGeometries.empty()) return;
+
+		//Every order starts from the same tree in creation order, traversed through the binary layout
+		std::vector<BVHLayout> meshLayouts{};
+		std::vector<BVHNodeOrder> meshNodeOrders{};
+		std::vector<std::vector<BVHNode>> creationNodes{};
+		for (auto& mesh : m_TriangleMeshGeometries)
+		{
+			meshLayouts.push_back(mesh.bvhLayout);
+			meshNodeOrders.push_back(mesh.bvhNodeOrder);
+			mesh.bvhNodeOrder = BVHNodeOrder::Creation;
+			mesh.BuildBVH();
+			creationNodes.push_back(mesh.bvhNodes);
+		}
+
+		m_Camera.CalculateCameraToWorld();
+		PerfCounters perfCounters{};
+		const int amountOfRuns{ 5 };
+		for (const BVHNodeOrder order : { BVHNodeOrder::Creation, BVHNodeOrder::VanEmdeBoas, BVHNodeOrder::AccessFrequency })
+		{
+			for (size_t meshIdx{}; meshIdx < m_TriangleMeshGeometries.size(); ++meshIdx)
+			{
+				TriangleMesh& mesh{ m_TriangleMeshGeometries[meshIdx] };
+				mesh.bvhNodes = creationNodes[meshIdx];
+				mesh.rootNodeIdx = 0;
+				mesh.bvhLayout = BVHLayout::Binary;
+				mesh.ReorderBVHNodes(order);
+			}
+			if (order == BVHNodeOrder::AccessFrequency)
+			{
+				ProfileBVHNodes(width, height);
+			}
+
+			//Counters are taken from the fastest run
+			double bestTime{ DBL_MAX };
+			uint64_t rayCount{};
+			uint64_t counterValues[static_cast<int>(PerfCounters::Counter::Count)]{};
+			for (int run{}; run < amountOfRuns; ++run)
+			{
+				perfCounters.Start();
+				const auto start{ std::chrono::high_resolution_clock::now() };
+				const SampleRayCounts rayCounts{ TraceSampleRays(width, height) };
+				rayCount = rayCounts.primaryRays + rayCounts.shadowRays;
+				const auto end{ std::chrono::high_resolution_clock::now() };
+				perfCounters.Stop();
+
+				const double time{ std::chrono::duration<double, std::milli>(end - start).count() };
+				if (time >= bestTime) continue;
+
+				bestTime = time;
+				for (int i{}; i < static_cast<int>(PerfCounters::Counter::Count); ++i)
+				{
+					counterValues[i] = perfCounters.GetValue(static_cast<PerfCounters::Counter>(i));
+				}
+			}
+
+			std::cout << "BVH node order >> " << GetBVHNodeOrderName(order) << " | ms: " << bestTime
+				<< " | Mrays/s: " << rayCount / (bestTime * 1000.0);
+			for (int i{}; i < static_cast<int>(PerfCounters::Counter::Count); ++i)
+			{
+				const PerfCounters::Counter counter{ static_cast<PerfCounters::Counter>(i) };
+				if (!perfCounters.IsAvailable(counter)) continue;
+				std::cout << " | " << PerfCounters::GetName(counter) << "/ray: " << static_cast<double>(counterValues[i]) / rayCount;
+			}
+			std::cout << std::endl;
+		}
+
+		//Restore the layout and node order each mesh was configured for, the last pass left a fresh profile
+		for (size_t meshIdx{}; meshIdx < m_TriangleMeshGeometries.size(); ++meshIdx)
+		{
+			TriangleMesh& mesh{ m_TriangleMeshGeometries[meshIdx] };
+			mesh.bvhLayout = meshLayouts[meshIdx];
+			mesh.bvhNodeOrder = meshNodeOrders[meshIdx];
+			if (mesh.bvhNodeOrder != BVHNodeOrder::AccessFrequency)
+			{
+				mesh.bvhNodes = creationNodes[meshIdx];
+				mesh.rootNodeIdx = 0;
+				mesh.ReorderBVHNodes(mesh.bvhNodeOrder);
+			}
+		}
+	}
+
+	double Scene::RebuildBVHs()
+	{
+		const auto start{ std::chrono::high_resolution_clock::now() };
+		for (auto& mesh : m_TriangleMeshGeometries)
+		{
+			mesh.BuildBVH();
+		}
+		const auto end{ std::chrono::high_resolution_clock::now() };
+		return std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	void Scene::CountRays(uint32_t width, uint32_t height, uint64_t& primaryRays, uint64_t& shadowRays)
+	{
+		m_Camera.CalculateCameraToWorld();
+		const SampleRayCounts rayCounts{ TraceSampleRays(width, height, 1, false) };
+		primaryRays = rayCounts.primaryRays;
+		shadowRays = rayCounts.shadowRays;
+	}
+
+	void Scene::BuildTLAS()
+	{
+		UpdateInstanceBounds();
+		m_TLAS.Build(m_InstanceBounds);
+	}
+
+	void Scene::RefitTLAS()
+	{
+		//Only the transforms may change between frames, rebuild if objects were added or removed
+		if (m_TLAS.GetInstanceCount() != m_SphereGeometries.size() + m_TriangleMeshGeometries.size())
+		{
+			BuildTLAS();
+			return;
+		}
+
+		UpdateInstanceBounds();
+		m_TLAS.Refit(m_InstanceBounds);
+	}
+
+	void Scene::UpdateInstanceBounds()
+	{
+		m_InstanceBounds.clear();
+		m_InstanceBounds.reserve(m_SphereGeometries.size() + m_TriangleMeshGeometries.size());
+		for (const auto& sphere : m_SphereGeometries)
+		{
+			const Vector3 radius{ sphere.radius, sphere.radius, sphere.radius };
+			m_InstanceBounds.push_back({ sphere.origin - radius, sphere.origin + radius });
+		}
+
+		for (const auto& mesh : m_TriangleMeshGeometries)
+		{
+			m_InstanceBounds.push_back({ mesh.transformedMinAABB, mesh.transformedMaxAABB });
+		}
 	}
 
 #pragma region Scene Helpers
@@ -152,9 +717,9 @@ namespace dae {
 		return &m_Lights.back();
 	}
 
-	unsigned char Scene::AddMaterial(Material* pMaterial)
+	unsigned char Scene::AddMaterial(const Material& material)
 	{
-		m_Materials.push_back(pMaterial);
+		m_Materials.push_back(material);
 		return static_cast<unsigned char>(m_Materials.size() - 1);
 	}
 #pragma endregion
@@ -165,11 +730,11 @@ namespace dae {
 	{
 		//default: Material id0 >> SolidColor Material (RED)
 		constexpr unsigned char matId_Solid_Red = 0;
-		const unsigned char matId_Solid_Blue = AddMaterial(new Material_SolidColor{ colors::Blue });
+		const unsigned char matId_Solid_Blue = AddMaterial(Material_SolidColor{ colors::Blue });
 
-		const unsigned char matId_Solid_Yellow = AddMaterial(new Material_SolidColor{ colors::Yellow });
-		const unsigned char matId_Solid_Green = AddMaterial(new Material_SolidColor{ colors::Green });
-		const unsigned char matId_Solid_Magenta = AddMaterial(new Material_SolidColor{ colors::Magenta });
+		const unsigned char matId_Solid_Yellow = AddMaterial(Material_SolidColor{ colors::Yellow });
+		const unsigned char matId_Solid_Green = AddMaterial(Material_SolidColor{ colors::Green });
+		const unsigned char matId_Solid_Magenta = AddMaterial(Material_SolidColor{ colors::Magenta });
 
 		//Spheres
 		AddSphere({ -25.f, 0.f, 100.f }, 50.f, matId_Solid_Red);
@@ -181,6 +746,8 @@ namespace dae {
 		AddPlane({ 0.f, -75.f, 0.f }, { 0.f, 1.f,0.f }, matId_Solid_Yellow);
 		AddPlane({ 0.f, 75.f, 0.f }, { 0.f, -1.f,0.f }, matId_Solid_Yellow);
 		AddPlane({ 0.f, 0.f, 125.f }, { 0.f, 0.f,-1.f }, matId_Solid_Magenta);
+
+		BuildTLAS();
 	}
 #pragma endregion
 
@@ -192,10 +759,10 @@ namespace dae {
 
 		//default: Material id0 >> SolidColor Material (Red)
 		constexpr unsigned char matId_Solid_Red = 0;
-		const unsigned char matId_Solid_Blue = AddMaterial(new Material_SolidColor{ colors::Blue });
-		const unsigned char matId_Solid_Yellow = AddMaterial(new Material_SolidColor{ colors::Yellow });
-		const unsigned char matId_Solid_Green = AddMaterial(new Material_SolidColor{ colors::Green });
-		const unsigned char matId_Solid_Magenta = AddMaterial(new Material_SolidColor{ colors::Magenta });
+		const unsigned char matId_Solid_Blue = AddMaterial(Material_SolidColor{ colors::Blue });
+		const unsigned char matId_Solid_Yellow = AddMaterial(Material_SolidColor{ colors::Yellow });
+		const unsigned char matId_Solid_Green = AddMaterial(Material_SolidColor{ colors::Green });
+		const unsigned char matId_Solid_Magenta = AddMaterial(Material_SolidColor{ colors::Magenta });
 
 		//Plane
 		AddPlane({ -5.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, matId_Solid_Green);
@@ -215,6 +782,8 @@ namespace dae {
 		//Light
 		AddPointLight({ 0.f, 5.f, -5.f }, 70.f, colors::White);
 		//AddPointLight({ 0.f, 5.f, -9.f }, 70.f, colors::White);
+
+		BuildTLAS();
 	}
 #pragma endregion
 
@@ -226,9 +795,9 @@ namespace dae {
 		m_Camera.SetCameraFOV(45.f);
 
 		//Materials
-		const auto matLambert_Red = AddMaterial(new Material_Lambert(colors::Red, 1.f));
-		const auto matLambertPhong_Blue = AddMaterial(new Material_LambertPhong( colors::Blue, 1.f, 1.f, 60.f));
-		const auto matLambert_Yellow = AddMaterial(new Material_Lambert( colors::Yellow, 1.f));
+		const auto matLambert_Red = AddMaterial(Material_Lambert(colors::Red, 1.f));
+		const auto matLambertPhong_Blue = AddMaterial(Material_LambertPhong( colors::Blue, 1.f, 1.f, 60.f));
+		const auto matLambert_Yellow = AddMaterial(Material_Lambert( colors::Yellow, 1.f));
 
 		//Plane
 		AddPlane({ 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, matLambert_Yellow);
@@ -240,6 +809,8 @@ namespace dae {
 		//Light
 		AddPointLight({ 0.f, 5.f, 5.f }, 25.f, colors::White);
 		AddPointLight({ 0.f, 2.5f, -5.f }, 25.f, colors::White);
+
+		BuildTLAS();
 	}
 
 	void Scene_W3::Initialize()
@@ -247,19 +818,19 @@ namespace dae {
 		m_Camera.origin = { 0.f, 3.f, -9.f };
 		m_Camera.SetCameraFOV(45.f);
 
-		const auto matCT_GrayRoughMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 1.f));
-		const auto matCT_GrayMediumMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 0.6f));
-		const auto matCT_GraySmoothMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 0.1f));
+		const auto matCT_GrayRoughMetal = AddMaterial(Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 1.f));
+		const auto matCT_GrayMediumMetal = AddMaterial(Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 0.6f));
+		const auto matCT_GraySmoothMetal = AddMaterial(Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 0.1f));
 
-		const auto matCT_GrayRoughPlastic = AddMaterial(new Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 1.f));
-		const auto matCT_GrayMediumPlastic = AddMaterial(new Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.6f));
-		const auto matCT_GraySmoothPlastic = AddMaterial(new Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.1f));
+		const auto matCT_GrayRoughPlastic = AddMaterial(Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 1.f));
+		const auto matCT_GrayMediumPlastic = AddMaterial(Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.6f));
+		const auto matCT_GraySmoothPlastic = AddMaterial(Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.1f));
 
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
+		const auto matLambert_GrayBlue = AddMaterial(Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
 
-		const auto matLambertPhong1 = AddMaterial(new Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 3.f));
-		const auto matLambertPhong2 = AddMaterial(new Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 15.f));
-		const auto matLambertPhong3 = AddMaterial(new Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 30.f));
+		const auto matLambertPhong1 = AddMaterial(Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 3.f));
+		const auto matLambertPhong2 = AddMaterial(Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 15.f));
+		const auto matLambertPhong3 = AddMaterial(Material_LambertPhong(colors::Blue, 0.5f, 0.5f, 30.f));
 
 		//Plane
 		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GrayBlue);
@@ -283,6 +854,8 @@ namespace dae {
 		AddPointLight({ 0.f, 5.f, 5.f }, 50.f, ColorRGB{1.f, 0.61f, 0.45f});
 		AddPointLight({ -2.5f, 5.f, -5.f }, 70.f, ColorRGB{ 1.f, 0.8f, 0.45f });
 		AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, ColorRGB{ 0.34f, 0.47f, 0.68f });
+
+		BuildTLAS();
 	}
 #pragma endregion
 #pragma region SCENE W4
@@ -292,8 +865,8 @@ namespace dae {
 		m_Camera.SetCameraFOV(45.f);
 
 		//Materials
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
-		const auto matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.f));
+		const auto matLambert_GrayBlue = AddMaterial(Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
+		const auto matLambert_White = AddMaterial(Material_Lambert(colors::White, 1.f));
 
 		//Plane
 		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GrayBlue);
@@ -307,6 +880,8 @@ namespace dae {
 		Utils::ParseOBJ("Resources/simple_object.obj", m_pMesh->positions, m_pMesh->normals, m_pMesh->indices);
 		m_pMesh->Scale({ 0.7f, 0.7f, 0.7f });
 		m_pMesh->Translate({ 0.f, 1.0f, 0.f });
+		m_pMesh->UpdateAABB();
+		m_pMesh->BuildBVH();
 		m_pMesh->UpdateTransforms();
 
 		//Triangle (Temp)
@@ -319,12 +894,68 @@ namespace dae {
 		AddPointLight({ 0.f, 5.f, 5.f }, 50.f, ColorRGB{ 1.f, 0.61f, 0.45f });
 		AddPointLight({ -2.5f, 5.f, -5.f }, 70.f, ColorRGB{ 1.f, 0.8f, 0.45f });
 		AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, ColorRGB{ 0.34f, 0.47f, 0.68f });
+
+		BuildTLAS();
 	}
 	void Scene_W4_TestScene::Update(Timer* pTimer)
 	{
 		Scene::Update(pTimer);
 		m_pMesh->RotateY(PI_DIV_2 * pTimer->GetTotal());
 		m_pMesh->UpdateTransforms();
+		RefitTLAS();
+	}
+
+	void Scene_W4_DeformingScene::Initialize()
+	{
+		sceneName = "Deforming Scene";
+		m_Camera.origin = { 0.f, 1.f, -5.f };
+		m_Camera.SetCameraFOV(45.f);
+
+		//Materials
+		const auto matLambert_GrayBlue = AddMaterial(Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
+		const auto matLambert_White = AddMaterial(Material_Lambert(colors::White, 1.f));
+
+		//Plane
+		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GrayBlue);
+		AddPlane({ 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, matLambert_GrayBlue);
+		AddPlane({ 0.f, 10.f, 0.f }, { 0.f, -1.f, 0.f }, matLambert_GrayBlue);
+		AddPlane({ 5.f, 0.f, 0.f }, { -1.f, 0.f, 0.f }, matLambert_GrayBlue);
+		AddPlane({ -5.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, matLambert_GrayBlue);
+
+		//TriangleMesh
+		m_pMesh = AddTriangleMesh(TriangleCullMode::BackFaceCulling, matLambert_White);
+		Utils::ParseOBJ("Resources/simple_object.obj", m_pMesh->positions, m_pMesh->normals, m_pMesh->indices);
+		m_pMesh->Scale({ 0.7f, 0.7f, 0.7f });
+		m_pMesh->Translate({ 0.f, 1.0f, 0.f });
+		m_pMesh->UpdateAABB();
+		m_pMesh->BuildBVH();
+		m_pMesh->UpdateTransforms();
+		m_RestPositions = m_pMesh->positions;
+
+		//Light
+		AddPointLight({ 0.f, 5.f, 5.f }, 50.f, ColorRGB{ 1.f, 0.61f, 0.45f });
+		AddPointLight({ -2.5f, 5.f, -5.f }, 70.f, ColorRGB{ 1.f, 0.8f, 0.45f });
+		AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, ColorRGB{ 0.34f, 0.47f, 0.68f });
+
+		BuildTLAS();
+	}
+	void Scene_W4_DeformingScene::Update(Timer* pTimer)
+	{
+		Scene::Update(pTimer);
+
+		//Ripple the object along its height, the topology of its BVH is kept and only the bounds are refit
+		const float totalTime{ pTimer->GetTotal() };
+		for (size_t idx{}; idx < m_RestPositions.size(); ++idx)
+		{
+			const Vector3& restPosition{ m_RestPositions[idx] };
+			const float scale{ 1.f + 0.15f * sinf(2.f * totalTime + 4.f * restPosition.y) };
+			m_pMesh->positions[idx] = { restPosition.x * scale, restPosition.y, restPosition.z * scale };
+		}
+
+		m_pMesh->RotateY(PI_DIV_2 * totalTime);
+		//Also updates the object bounds and the transforms
+		m_pMesh->Refit();
+		RefitTLAS();
 	}
 
 	void Scene_W4_ReferenceScene::Initialize()
@@ -333,16 +964,16 @@ namespace dae {
 		m_Camera.origin = { 0.f, 3.f, -9.f };
 		m_Camera.SetCameraFOV(45.f);
 
-		const auto matCT_GrayRoughMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 1.f));
-		const auto matCT_GrayMediumMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 0.6f));
-		const auto matCT_GraySmoothMetal = AddMaterial(new Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 0.1f));
+		const auto matCT_GrayRoughMetal = AddMaterial(Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 1.f));
+		const auto matCT_GrayMediumMetal = AddMaterial(Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 0.6f));
+		const auto matCT_GraySmoothMetal = AddMaterial(Material_CookTorrence({ 0.972f, 0.960f, 0.915f }, 1.f, 0.1f));
 
-		const auto matCT_GrayRoughPlastic = AddMaterial(new Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 1.f));
-		const auto matCT_GrayMediumPlastic = AddMaterial(new Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.6f));
-		const auto matCT_GraySmoothPlastic = AddMaterial(new Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.1f));
+		const auto matCT_GrayRoughPlastic = AddMaterial(Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 1.f));
+		const auto matCT_GrayMediumPlastic = AddMaterial(Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.6f));
+		const auto matCT_GraySmoothPlastic = AddMaterial(Material_CookTorrence({ 0.75f, 0.75f, 0.75f }, 0.f, 0.1f));
 
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
-		const auto matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.f));
+		const auto matLambert_GrayBlue = AddMaterial(Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
+		const auto matLambert_White = AddMaterial(Material_Lambert(colors::White, 1.f));
 
 		//Plane
 		AddPlane({ 0.f, 0.f, 10.f }, { 0.f, 0.f, -1.f }, matLambert_GrayBlue);
@@ -365,28 +996,30 @@ namespace dae {
 		m_Meshes[0] = AddTriangleMesh(TriangleCullMode::BackFaceCulling, matLambert_White);
 		m_Meshes[0]->AppendTriangle(baseTriangle, true);
 		m_Meshes[0]->Translate({ -1.75f, 4.5, 0.f });
-		m_Meshes[0]->pBVHNodes = new BVHNode[m_Meshes[0]->indices.size()];
 		m_Meshes[0]->UpdateAABB();
+		m_Meshes[0]->BuildBVH();
 		m_Meshes[0]->UpdateTransforms();
 
 		m_Meshes[1] = AddTriangleMesh(TriangleCullMode::FrontFaceCulling, matLambert_White);
 		m_Meshes[1]->AppendTriangle(baseTriangle, true);
 		m_Meshes[1]->Translate({ 0, 4.5, 0.f });
-		m_Meshes[1]->pBVHNodes = new BVHNode[m_Meshes[1]->indices.size()];
 		m_Meshes[1]->UpdateAABB();
+		m_Meshes[1]->BuildBVH();
 		m_Meshes[1]->UpdateTransforms();
 
 		m_Meshes[2] = AddTriangleMesh(TriangleCullMode::NoCulling, matLambert_White);
 		m_Meshes[2]->AppendTriangle(baseTriangle, true);
 		m_Meshes[2]->Translate({ 1.75f, 4.5, 0.f });
-		m_Meshes[2]->pBVHNodes = new BVHNode[m_Meshes[2]->indices.size()];
 		m_Meshes[2]->UpdateAABB();
+		m_Meshes[2]->BuildBVH();
 		m_Meshes[2]->UpdateTransforms();
 
 		//Light
 		AddPointLight({ 0.f, 5.f, 5.f }, 50.f, ColorRGB{ 1.f, 0.61f, 0.45f });
 		AddPointLight({ -2.5f, 5.f, -5.f }, 70.f, ColorRGB{ 1.f, 0.8f, 0.45f });
 		AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, ColorRGB{ 0.34f, 0.47f, 0.68f });
+
+		BuildTLAS();
 	}
 	void Scene_W4_ReferenceScene::Update(Timer* pTimer)
 	{
@@ -397,6 +1030,7 @@ namespace dae {
 			m->RotateY(yawAngle);
 			m->UpdateTransforms();
 		}
+		RefitTLAS();
 	}
 
 	void Scene_W4_BunnyScene::Initialize()
@@ -405,15 +1039,16 @@ namespace dae {
 		m_Camera.origin = { 0.f, 3.f, -9.f };
 		m_Camera.SetCameraFOV(45.f);
 
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
-		const auto matLambert_White = AddMaterial(new Material_Lambert(colors::White, 1.f));
+		const auto matLambert_GrayBlue = AddMaterial(Material_Lambert({ 0.49f, 0.57f, 0.57f }, 1.f));
+		const auto matLambert_White = AddMaterial(Material_Lambert(colors::White, 1.f));
 
 		//TriangleMesh
 		m_pMesh = AddTriangleMesh(TriangleCullMode::BackFaceCulling, matLambert_White);
 		Utils::ParseOBJ("Resources/lowpoly_bunny2.obj", m_pMesh->positions, m_pMesh->normals, m_pMesh->indices);
 		m_pMesh->Scale({ 2.f, 2.f, 2.f });
-		m_pMesh->pBVHNodes = new BVHNode[m_pMesh->indices.size()];
 		m_pMesh->UpdateAABB();
+		m_pMesh->optimizationTimeBudget = 500.f;
+		m_pMesh->BuildBVH();
 		m_pMesh->UpdateTransforms();
 
 		//Plane
@@ -427,6 +1062,8 @@ namespace dae {
 		AddPointLight({ 0.f, 5.f, 5.f }, 50.f, ColorRGB{ 1.f, 0.61f, 0.45f });
 		AddPointLight({ -2.5f, 5.f, -5.f }, 70.f, ColorRGB{ 1.f, 0.8f, 0.45f });
 		AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, ColorRGB{ 0.34f, 0.47f, 0.68f });
+
+		BuildTLAS();
 	}
 	void Scene_W4_BunnyScene::Update(Timer* pTimer)
 	{
@@ -434,6 +1071,7 @@ namespace dae {
 		const auto yawAngle{ (cosf(pTimer->GetTotal()) + 1.f) / 2.f * PI_2 };
 		m_pMesh->RotateY(yawAngle);
 		m_pMesh->UpdateTransforms();
+		RefitTLAS();
 	}
 #pragma endregion
 	void Scene_W4_OptionalScene::Initialize()
@@ -442,15 +1080,18 @@ namespace dae {
 		m_Camera.origin = { 0.f, 2.f, -9.f };
 		m_Camera.SetCameraFOV(45.f);
 
-		const auto matLambert_GrayBlue = AddMaterial(new Material_Lambert(ColorRGB{ 0.49f, 0.57f, 0.57f }, 1.f));
-		const auto matLambert_White = AddMaterial(new Material_CookTorrence(ColorRGB{0.72f, 0.254f, 0.055f}, 1.0f, 0.7f));
+		const auto matLambert_GrayBlue = AddMaterial(Material_Lambert(ColorRGB{ 0.49f, 0.57f, 0.57f }, 1.f));
+		const auto matLambert_White = AddMaterial(Material_CookTorrence(ColorRGB{0.72f, 0.254f, 0.055f}, 1.0f, 0.7f));
 
 		//TriangleMesh
 		m_pMesh = AddTriangleMesh(TriangleCullMode::BackFaceCulling, matLambert_White);
 		Utils::ParseOBJ("Resources/Assignment3D1.obj", m_pMesh->positions, m_pMesh->normals, m_pMesh->indices);
 		m_pMesh->Scale({ 0.03f, 0.03f, 0.03f });
-		m_pMesh->pBVHNodes = new BVHNode[m_pMesh->indices.size()];
 		m_pMesh->UpdateAABB();
+		//Static mesh with long, thin triangles: worth the spatial split build and tree rotations
+		m_pMesh->bvhBuilder = BVHBuilder::SpatialSAH;
+		m_pMesh->optimizationTimeBudget = 500.f;
+		m_pMesh->BuildBVH();
 		m_pMesh->UpdateTransforms();
 
 		//Plane
@@ -464,6 +1105,8 @@ namespace dae {
 		AddPointLight({ 0.f, 5.f, 5.f }, 50.f, ColorRGB{ 1.f, 0.61f, 0.45f });
 		AddPointLight({ -2.5f, 5.f, -5.f }, 70.f, ColorRGB{ 1.f, 0.8f, 0.45f });
 		AddPointLight({ 2.5f, 2.5f, -5.f }, 50.f, ColorRGB{ 0.34f, 0.47f, 0.68f });
+
+		BuildTLAS();
 	}
 	void Scene_W4_OptionalScene::Update(Timer* pTimer)
 	{
@@ -471,5 +1114,30 @@ namespace dae {
 		const auto yawAngle{ (cosf(pTimer->GetTotal()) + 1.f) / 2.f * PI_2 };
 		m_pMesh->RotateY(yawAngle);
 		m_pMesh->UpdateTransforms();
+		RefitTLAS();
+	}
+
+	const std::vector<std::string_view>& GetSceneNames()
+	{
+		static const std::vector<std::string_view> sceneNames
+		{
+			"W1", "W2", "W3", "W3_TestScene", "W4_TestScene", "W4_DeformingScene", "W4_ReferenceScene", "W4_BunnyScene",
+			"W4_OptionalScene"
+		};
+		return sceneNames;
+	}
+
+	Scene* CreateScene(std::string_view name)
+	{
+		if (name == "W1") return new Scene_W1();
+		if (name == "W2") return new Scene_W2();
+		if (name == "W3") return new Scene_W3();
+		if (name == "W3_TestScene") return new Scene_W3_TestScene();
+		if (name == "W4_TestScene") return new Scene_W4_TestScene();
+		if (name == "W4_DeformingScene") return new Scene_W4_DeformingScene();
+		if (name == "W4_ReferenceScene") return new Scene_W4_ReferenceScene();
+		if (name == "W4_BunnyScene") return new Scene_W4_BunnyScene();
+		if (name == "W4_OptionalScene") return new Scene_W4_OptionalScene();
+		return nullptr;
 	}
-}
\ No newline at end of file
+}
@@ -1,16 +1,17 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "Math.h"
 #include "DataTypes.h"
 #include "Camera.h"
+#include "Material.h"
 
 namespace dae
 {
 	//Forward Declarations
 	class Timer;
-	class Material;
 	struct Plane;
 	struct Sphere;
 	struct Light;
@@ -28,19 +29,31 @@ namespace dae
 		Scene& operator=(Scene&&) noexcept = delete;
 
 		virtual void Initialize() = 0;
-		virtual void Update(dae::Timer* pTimer)
+		//Animates the scene, the camera is moved by whoever owns the input before this is called
+		virtual void Update(dae::Timer* /*pTimer*/)
 		{
-			m_Camera.Update(pTimer);
 		}
 
 		Camera& GetCamera() { return m_Camera; }
 		void GetClosestHit(const Ray& ray, HitRecord& closestHit) const;
+		void GetClosestHit(const RayPacket& packet, HitRecord* pClosestHits) const;
 		bool DoesHit(const Ray& ray) const;
 
+		void CycleBVHLayout();
+		void PrintBVHStatistics() const;
+		void BenchmarkBVHBuild();
+		void OptimizeBVHLayout(uint32_t width, uint32_t height);
+		void BenchmarkBVHLayout(uint32_t width, uint32_t height);
+		void BenchmarkTriangleTests() const;
+		//Rebuilds the BVH of every mesh with the builder it was configured for, returns the milliseconds it took
+		double RebuildBVHs();
+		//Primary and shadow rays a render of the current view traces with shadows enabled, without tracing the shadow rays
+		void CountRays(uint32_t width, uint32_t height, uint64_t& primaryRays, uint64_t& shadowRays);
+
 		const std::vector<Plane>& GetPlaneGeometries() const { return m_PlaneGeometries; }
 		const std::vector<Sphere>& GetSphereGeometries() const { return m_SphereGeometries; }
 		const std::vector<Light>& GetLights() const { return m_Lights; }
-		const std::vector<Material*> GetMaterials() const { return m_Materials; }
+		const std::vector<Material>& GetMaterials() const { return m_Materials; }
 
 	protected:
 		std::string	sceneName;
@@ -49,7 +62,11 @@ namespace dae
 		std::vector<Sphere> m_SphereGeometries{};
 		std::vector<TriangleMesh> m_TriangleMeshGeometries{};
 		std::vector<Light> m_Lights{};
-		std::vector<Material*> m_Materials{};
+		std::vector<Material> m_Materials{};
+
+		//Top level acceleration structure, instances [0, spheres) are spheres, the rest are triangle meshes
+		TLAS m_TLAS{};
+		std::vector<AABB> m_InstanceBounds{};
 		//Temp
 		//std::vector<Triangle> m_Triangles{};
 
@@ -61,7 +78,28 @@ namespace dae
 
 		Light* AddPointLight(const Vector3& origin, float intensity, const ColorRGB& color);
 		Light* AddDirectionalLight(const Vector3& direction, float intensity, const ColorRGB& color);
-		unsigned char AddMaterial(Material* pMaterial);
+		unsigned char AddMaterial(const Material& material);
+
+		void BuildTLAS();
+		void RefitTLAS();
+
+	private:
+		void UpdateInstanceBounds();
+		static const char* GetBVHBuilderName(BVHBuilder builder);
+		static const char* GetBVHNodeOrderName(BVHNodeOrder order);
+		void ProfileBVHNodes(uint32_t width, uint32_t height);
+		//Ray queries of the whole scene, the profiling instantiations count the binary BVH node visits into pNodeVisits[meshIdx]
+		template<bool profileNodes>
+		void FindClosestHit(const Ray& ray, HitRecord& closestHit, std::vector<unsigned int>* pNodeVisits = nullptr) const;
+		template<bool profileNodes>
+		bool FindAnyHit(const Ray& ray, std::vector<unsigned int>* pNodeVisits = nullptr) const;
+		struct SampleRayCounts
+		{
+			uint64_t primaryRays{};
+			uint64_t shadowRays{};
+		};
+		template<bool profileNodes = false>
+		SampleRayCounts TraceSampleRays(uint32_t width, uint32_t height, uint32_t pixelStep = 1, bool traceShadowRays = true, std::vector<unsigned int>* pNodeVisits = nullptr) const;
 	};
 
 	//+++++++++++++++++++++++++++++++++++++++++
@@ -146,6 +184,27 @@ namespace dae
 		TriangleMesh* m_pMesh{ nullptr };
 	};
 
+	//The test scene with a mesh that deforms every frame, its BVH is refit instead of rebuilt
+	class Scene_W4_DeformingScene final : public Scene
+	{
+	public:
+		Scene_W4_DeformingScene() = default;
+		~Scene_W4_DeformingScene() override = default;
+
+		Scene_W4_DeformingScene(const Scene_W4_DeformingScene&) = delete;
+		Scene_W4_DeformingScene(Scene_W4_DeformingScene&&) noexcept = delete;
+		Scene_W4_DeformingScene& operator=(const Scene_W4_DeformingScene&) = delete;
+		Scene_W4_DeformingScene& operator=(Scene_W4_DeformingScene&&) noexcept = delete;
+
+		void Initialize() override;
+		void Update(Timer* pTimer) override;
+
+	private:
+		TriangleMesh* m_pMesh{ nullptr };
+		//Object space positions the animation deforms every frame
+		std::vector<Vector3> m_RestPositions{};
+	};
+
 	class Scene_W4_ReferenceScene final : public Scene
 	{
 	public:
@@ -199,4 +258,9 @@ namespace dae
 	private:
 		TriangleMesh* m_pMesh{ nullptr };
 	};
+
+	//Names of the built in scenes, the class names without the Scene_ prefix
+	const std::vector<std::string_view>& GetSceneNames();
+	//Uninitialized scene of the given name, nullptr for an unknown name
+	Scene* CreateScene(std::string_view name);
 }
@@ -0,0 +1,190 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+using namespace dae;
+
+namespace
+{
+	//The pool a thread is working for and its deque in there, a loop started from one of its tasks is nested
+	struct CurrentWorker
+	{
+		const ThreadPool* pPool;
+		unsigned int workerIdx;
+	};
+
+	thread_local CurrentWorker s_CurrentWorker{};
+}
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+{
+	if (threadCount == 0)
+	{
+		threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	for (unsigned int workerIdx{}; workerIdx < threadCount; ++workerIdx)
+	{
+		m_Workers.push_back(std::make_unique<Worker>());
+	}
+	//Worker 0 is the thread calling ParallelFor
+	for (unsigned int workerIdx{ 1 }; workerIdx < threadCount; ++workerIdx)
+	{
+		m_Threads.emplace_back(&ThreadPool::WorkerLoop, this, workerIdx);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		const std::lock_guard lock{ m_JobMutex };
+		m_IsStopping = true;
+	}
+	m_JobStarted.notify_all();
+
+	for (std::thread& thread : m_Threads)
+	{
+		thread.join();
+	}
+}
+
+void ThreadPool::Run(uint32_t count, uint32_t grainSize, TaskFunction function, const void* pFunction)
+{
+	if (count == 0) return;
+
+	grainSize = std::max(grainSize, 1u);
+	const uint32_t taskCount{ (count + grainSize - 1) / grainSize };
+	const uint32_t workerCount{ GetThreadCount() };
+	if (workerCount == 1 || taskCount == 1)
+	{
+		function(pFunction, 0, count);
+		return;
+	}
+
+	//The calling thread works as thread 0, unless it is already running a task of this pool
+	const CurrentWorker previousWorker{ s_CurrentWorker };
+	const bool isNested{ previousWorker.pPool == this };
+	if (!isNested)
+	{
+		s_CurrentWorker = { this, 0 };
+	}
+	const unsigned int callerIdx{ s_CurrentWorker.workerIdx };
+
+	std::atomic<uint32_t> remainingTasks{ taskCount };
+	if (isNested)
+	{
+		//In front of whatever the deque still holds, so this thread gets to its own loop first and thieves take the rest
+		Worker& worker{ *m_Workers[callerIdx] };
+		const std::lock_guard lock{ worker.mutex };
+		for (uint32_t taskIdx{ taskCount }; taskIdx-- > 0;)
+		{
+			worker.tasks.push_front({ function, pFunction, taskIdx * grainSize, std::min(count, (taskIdx + 1) * grainSize), &remainingTasks });
+		}
+	}
+	else
+	{
+		//Every worker starts with a contiguous block of tasks, neighbouring tasks touch neighbouring memory
+		for (uint32_t workerIdx{}; workerIdx < workerCount; ++workerIdx)
+		{
+			const uint32_t firstTask{ static_cast<uint32_t>(static_cast<uint64_t>(taskCount) * workerIdx / workerCount) };
+			const uint32_t lastTask{ static_cast<uint32_t>(static_cast<uint64_t>(taskCount) * (workerIdx + 1) / workerCount) };
+
+			Worker& worker{ *m_Workers[workerIdx] };
+			const std::lock_guard lock{ worker.mutex };
+			for (uint32_t taskIdx{ firstTask }; taskIdx < lastTask; ++taskIdx)
+			{
+				worker.tasks.push_back({ function, pFunction, taskIdx * grainSize, std::min(count, (taskIdx + 1) * grainSize), &remainingTasks });
+			}
+		}
+	}
+
+	{
+		const std::lock_guard lock{ m_JobMutex };
+		++m_JobId;
+	}
+	m_JobStarted.notify_all();
+
+	//Keeps taking tasks of any loop until the own ones are done. Once there are none left to take,
+	//the last task to finish wakes this thread, tasks still running on other threads are not done yet.
+	while (remainingTasks != 0)
+	{
+		Task task{};
+		if (PopTask(callerIdx, task) || StealTask(callerIdx, task))
+		{
+			RunTask(task);
+			continue;
+		}
+
+		std::unique_lock lock{ m_JobMutex };
+		m_JobFinished.wait(lock, [&remainingTasks] { return remainingTasks == 0; });
+	}
+
+	s_CurrentWorker = previousWorker;
+}
+
+void ThreadPool::WorkerLoop(unsigned int workerIdx)
+{
+	s_CurrentWorker = { this, workerIdx };
+	uint64_t lastJobId{};
+	while (true)
+	{
+		{
+			std::unique_lock lock{ m_JobMutex };
+			m_JobStarted.wait(lock, [this, lastJobId] { return m_IsStopping || m_JobId != lastJobId; });
+			if (m_IsStopping) return;
+			lastJobId = m_JobId;
+		}
+
+		ProcessTasks(workerIdx);
+	}
+}
+
+void ThreadPool::ProcessTasks(unsigned int workerIdx)
+{
+	Task task{};
+	while (PopTask(workerIdx, task) || StealTask(workerIdx, task))
+	{
+		RunTask(task);
+	}
+}
+
+void ThreadPool::RunTask(const Task& task)
+{
+	task.function(task.pFunction, task.first, task.last);
+
+	//The counter lives on the stack of the waiting thread, it can be gone as soon as it reaches 0
+	if (task.pRemainingTasks->fetch_sub(1) == 1)
+	{
+		//Taking the lock orders this against the waiting thread checking the counter
+		const std::lock_guard lock{ m_JobMutex };
+		m_JobFinished.notify_all();
+	}
+}
+
+bool ThreadPool::PopTask(unsigned int workerIdx, Task& task)
+{
+	Worker& worker{ *m_Workers[workerIdx] };
+	const std::lock_guard lock{ worker.mutex };
+	if (worker.tasks.empty()) return false;
+
+	task = worker.tasks.front();
+	worker.tasks.pop_front();
+	return true;
+}
+
+bool ThreadPool::StealTask(unsigned int workerIdx, Task& task)
+{
+	//Victims are tried in order starting after the thief, taking the task their owner would reach last
+	const unsigned int workerCount{ GetThreadCount() };
+	for (unsigned int offset{ 1 }; offset < workerCount; ++offset)
+	{
+		Worker& victim{ *m_Workers[(workerIdx + offset) % workerCount] };
+		const std::lock_guard lock{ victim.mutex };
+		if (victim.tasks.empty()) continue;
+
+		task = victim.tasks.back();
+		victim.tasks.pop_back();
+		return true;
+	}
+	return false;
+}
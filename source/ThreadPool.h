@@ -0,0 +1,84 @@
+#pragma once
+
+//Standard includes
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dae
+{
+	//Persistent worker threads running parallel for loops split into tasks of grainSize indices.
+	//Every thread owns a deque that starts with a contiguous share of the tasks, it takes tasks from the front of its own
+	//deque and steals from the back of the others once it runs dry. The calling thread works along as thread 0.
+	//A task can start a nested loop on the same pool: its tasks go on the deque of the thread running the task,
+	//which keeps running tasks until the nested loop is done, so the pool never needs more threads than it has.
+	class ThreadPool final
+	{
+	public:
+		//threadCount includes the calling thread, 0 uses one thread per hardware thread
+		explicit ThreadPool(unsigned int threadCount = 0);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool(ThreadPool&&) noexcept = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		ThreadPool& operator=(ThreadPool&&) noexcept = delete;
+
+		unsigned int GetThreadCount() const { return static_cast<unsigned int>(m_Workers.size()); }
+
+		//Runs function(index) for every index in [0, count), returns once all are done.
+		//Can be called from the tasks of another loop running on this pool.
+		template<typename Function>
+		void ParallelFor(uint32_t count, uint32_t grainSize, const Function& function)
+		{
+			Run(count, grainSize, [](const void* pFunction, uint32_t first, uint32_t last)
+				{
+					const Function& function{ *static_cast<const Function*>(pFunction) };
+					for (uint32_t index{ first }; index < last; ++index)
+					{
+						function(index);
+					}
+				}, &function);
+		}
+
+	private:
+		using TaskFunction = void(*)(const void* pFunction, uint32_t first, uint32_t last);
+
+		//A task carries its loop body, so a thread that steals late can never run it with the body of another loop
+		struct Task
+		{
+			TaskFunction function;
+			const void* pFunction;
+			uint32_t first;
+			uint32_t last;
+			std::atomic<uint32_t>* pRemainingTasks; //Of the loop the task belongs to
+		};
+
+		struct Worker
+		{
+			std::mutex mutex{};
+			std::deque<Task> tasks{};
+		};
+
+		void Run(uint32_t count, uint32_t grainSize, TaskFunction function, const void* pFunction);
+		void WorkerLoop(unsigned int workerIdx);
+		void ProcessTasks(unsigned int workerIdx);
+		void RunTask(const Task& task);
+		bool PopTask(unsigned int workerIdx, Task& task);
+		bool StealTask(unsigned int workerIdx, Task& task);
+
+		std::vector<std::unique_ptr<Worker>> m_Workers{};
+		std::vector<std::thread> m_Threads{};
+
+		std::mutex m_JobMutex{};
+		std::condition_variable m_JobStarted{};
+		std::condition_variable m_JobFinished{};
+		uint64_t m_JobId{};
+		bool m_IsStopping{};
+	};
+}
@@ -3,21 +3,34 @@
 #include <iostream>
 #include <numeric>
 
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
 #include <iostream>
 #include <fstream>
 
-#include "SDL.h"
 using namespace dae;
 
+namespace
+{
+	//Monotonic, counts in ticks of the steady clock
+	using Clock = std::chrono::steady_clock;
+
+	uint64_t GetPerformanceCounter()
+	{
+		return static_cast<uint64_t>(Clock::now().time_since_epoch().count());
+	}
+}
+
 Timer::Timer()
 {
-	const uint64_t countsPerSecond = SDL_GetPerformanceFrequency();
-	m_SecondsPerCount = 1.0f / static_cast<float>(countsPerSecond);
+	m_SecondsPerCount = static_cast<float>(Clock::period::num) / static_cast<float>(Clock::period::den);
 }
 
 void Timer::Reset()
 {
-	const uint64_t currentTime = SDL_GetPerformanceCounter();
+	const uint64_t currentTime = GetPerformanceCounter();
 
 	m_BaseTime = currentTime;
 	m_PreviousTime = currentTime;
@@ -29,7 +42,7 @@ void Timer::Reset()
 
 void Timer::Start()
 {
-	const uint64_t startTime = SDL_GetPerformanceCounter();
+	const uint64_t startTime = GetPerformanceCounter();
 
 	if (m_IsStopped)
 	{
@@ -60,6 +73,7 @@ void Timer::StartBenchmark(int numFrames)
 
 	m_Benchmarks.clear();
 	m_Benchmarks.resize(m_BenchmarkFrames);
+	ClearFrameTimes();
 
 	std::cout<< "**BENCHMARK STARTED**\n";
 }
@@ -74,7 +88,7 @@ void Timer::Update()
 		return;
 	}
 
-	const uint64_t currentTime = SDL_GetPerformanceCounter();
+	const uint64_t currentTime = GetPerformanceCounter();
 	m_CurrentTime = currentTime;
 
 	m_ElapsedTime = (float)((m_CurrentTime - m_PreviousTime) * m_SecondsPerCount);
@@ -83,6 +97,11 @@ void Timer::Update()
 	if (m_ElapsedTime < 0.0f)
 		m_ElapsedTime = 0.0f;
 
+	//Recorded before the upper bound is applied, the spikes are what the frame times are for
+	m_FrameTimes[m_NextFrameTimeIdx] = m_ElapsedTime * 1000.f;
+	m_NextFrameTimeIdx = (m_NextFrameTimeIdx + 1) % frameTimeCapacity;
+	m_FrameTimeCount = std::min(m_FrameTimeCount + 1, frameTimeCapacity);
+
 	if (m_ForceElapsedUpperBound && m_ElapsedTime > m_ElapsedUpperBound)
 	{
 		m_ElapsedTime = m_ElapsedUpperBound;
@@ -119,13 +138,30 @@ void Timer::Update()
 				std::cout << ">> LOW = " << m_BenchmarkLow << std::endl;
 				std::cout << ">> AVG = " << m_BenchmarkAvg << std::endl;
 
+				//Frame times of every frame since the benchmark started
+				const FrameTimeStatistics statistics{ GetFrameTimeStatistics() };
+				std::cout << ">> FRAME MS (" << statistics.frameCount << " frames): MIN = " << statistics.min
+					<< " | P50 = " << statistics.p50 << " | P90 = " << statistics.p90 << " | P99 = " << statistics.p99
+					<< " | MAX = " << statistics.max << " | STDDEV = " << statistics.standardDeviation << std::endl;
+
 				//file save
 				std::ofstream fileStream("benchmark.txt");
 				fileStream << "FRAMES = " << m_BenchmarkCurrFrame << std::endl;
 				fileStream << "HIGH = " << m_BenchmarkHigh << std::endl;
 				fileStream << "LOW = " << m_BenchmarkLow << std::endl;
 				fileStream << "AVG = " << m_BenchmarkAvg << std::endl;
+				fileStream << "FRAME_TIMES = " << statistics.frameCount << std::endl;
+				fileStream << "FRAME_MS_MIN = " << statistics.min << std::endl;
+				fileStream << "FRAME_MS_P50 = " << statistics.p50 << std::endl;
+				fileStream << "FRAME_MS_P90 = " << statistics.p90 << std::endl;
+				fileStream << "FRAME_MS_P99 = " << statistics.p99 << std::endl;
+				fileStream << "FRAME_MS_MAX = " << statistics.max << std::endl;
+				fileStream << "FRAME_MS_MEAN = " << statistics.mean << std::endl;
+				fileStream << "FRAME_MS_STDDEV = " << statistics.standardDeviation << std::endl;
 				fileStream.close();
+
+				if (!SaveFrameTimesToCSV("benchmark_frames.csv"))
+					std::cout << "Something went wrong. Frame times not saved!" << std::endl;
 			}
 		}
 	}
@@ -135,9 +171,78 @@ void Timer::Stop()
 {
 	if (!m_IsStopped)
 	{
-		const uint64_t currentTime = SDL_GetPerformanceCounter();
+		const uint64_t currentTime = GetPerformanceCounter();
 
 		m_StopTime = currentTime;
 		m_IsStopped = true;
 	}
 }
+
+std::vector<float> Timer::GetFrameTimes() const
+{
+	std::vector<float> frameTimes(m_FrameTimeCount);
+	const uint32_t firstIdx{ (m_NextFrameTimeIdx + frameTimeCapacity - m_FrameTimeCount) % frameTimeCapacity };
+	for (uint32_t frame{}; frame < m_FrameTimeCount; ++frame)
+	{
+		frameTimes[frame] = m_FrameTimes[(firstIdx + frame) % frameTimeCapacity];
+	}
+	return frameTimes;
+}
+
+FrameTimeStatistics Timer::GetFrameTimeStatistics() const
+{
+	return CalculateFrameTimeStatistics(GetFrameTimes());
+}
+
+FrameTimeStatistics Timer::CalculateFrameTimeStatistics(std::vector<float> frameTimes)
+{
+	FrameTimeStatistics statistics{};
+	statistics.frameCount = static_cast<uint32_t>(frameTimes.size());
+	if (frameTimes.empty()) return statistics;
+
+	std::sort(frameTimes.begin(), frameTimes.end());
+	//Nearest rank: the smallest frame time at least the given fraction of the frames doesn't exceed
+	const auto getPercentile = [&frameTimes](float fraction)
+		{
+			const size_t rank{ static_cast<size_t>(std::ceil(fraction * frameTimes.size())) };
+			return frameTimes[std::max(rank, size_t{ 1 }) - 1];
+		};
+	statistics.min = frameTimes.front();
+	statistics.p50 = getPercentile(0.5f);
+	statistics.p90 = getPercentile(0.9f);
+	statistics.p99 = getPercentile(0.99f);
+	statistics.max = frameTimes.back();
+
+	double sum{};
+	for (const float frameTime : frameTimes)
+	{
+		sum += frameTime;
+	}
+	const double mean{ sum / frameTimes.size() };
+	double squaredDeviationSum{};
+	for (const float frameTime : frameTimes)
+	{
+		squaredDeviationSum += (frameTime - mean) * (frameTime - mean);
+	}
+	statistics.mean = static_cast<float>(mean);
+	statistics.standardDeviation = static_cast<float>(std::sqrt(squaredDeviationSum / frameTimes.size()));
+	return statistics;
+}
+
+bool Timer::SaveFrameTimesToCSV(const char* filePath) const
+{
+	std::ofstream fileStream(filePath);
+	fileStream << "frame,ms\n";
+	const std::vector<float> frameTimes{ GetFrameTimes() };
+	for (size_t frame{}; frame < frameTimes.size(); ++frame)
+	{
+		fileStream << frame << ',' << frameTimes[frame] << '\n';
+	}
+	return static_cast<bool>(fileStream);
+}
+
+void Timer::ClearFrameTimes()
+{
+	m_FrameTimeCount = 0;
+	m_NextFrameTimeIdx = 0;
+}
@@ -6,6 +6,19 @@
 
 namespace dae
 {
+	//Frame times in milliseconds
+	struct FrameTimeStatistics
+	{
+		uint32_t frameCount{};
+		float min{};
+		float p50{};
+		float p90{};
+		float p99{};
+		float max{};
+		float mean{};
+		float standardDeviation{};
+	};
+
 	class Timer
 	{
 	public:
@@ -30,6 +43,13 @@ namespace dae
 		float GetTotal() const { return m_TotalTime; };
 		bool IsRunning() const { return !m_IsStopped; };
 
+		//The time of every Update is kept in a ring buffer of the last frameTimeCapacity frames, oldest first
+		std::vector<float> GetFrameTimes() const;
+		FrameTimeStatistics GetFrameTimeStatistics() const;
+		static FrameTimeStatistics CalculateFrameTimeStatistics(std::vector<float> frameTimes);
+		bool SaveFrameTimesToCSV(const char* filePath) const;
+		void ClearFrameTimes();
+
 	private:
 		uint64_t m_BaseTime = 0;
 		uint64_t m_PausedTime = 0;
@@ -57,5 +77,10 @@ namespace dae
 		int m_BenchmarkFrames{ 0 };
 		int m_BenchmarkCurrFrame{ 0 };
 		std::vector<float> m_Benchmarks{};
+
+		static constexpr uint32_t frameTimeCapacity{ 8192 };
+		std::vector<float> m_FrameTimes = std::vector<float>(frameTimeCapacity);
+		uint32_t m_FrameTimeCount{};
+		uint32_t m_NextFrameTimeIdx{};
 	};
 }
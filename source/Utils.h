@@ -1,19 +1,65 @@
 #pragma once
 #include <cassert>
+#include <cfloat>
+#include <cmath>
 #include <fstream>
+#include <bit>
+#include <type_traits>
+#include <immintrin.h>
 #include "Math.h"
 #include "DataTypes.h"
+#include "RayStatistics.h"
 #define BVH
 
 namespace dae
 {
 	namespace GeometryUtils
 	{
+		//Closest hit queries fill in the hitrecord, any hit queries (shadow rays) return on the first hit they find.
+		//The kernels below are instantiated per query (and per cull mode for triangles) instead of branching per test.
+		enum class HitQuery
+		{
+			ClosestHit,
+			AnyHit
+		};
+
+		//Shadow rays leave the surface, so they see every face from the side opposite to the view rays
+		constexpr TriangleCullMode GetQueryCullMode(HitQuery query, TriangleCullMode cullMode)
+		{
+			if (query == HitQuery::ClosestHit) return cullMode;
+			switch (cullMode)
+			{
+			case TriangleCullMode::FrontFaceCulling:
+				return TriangleCullMode::BackFaceCulling;
+			case TriangleCullMode::BackFaceCulling:
+				return TriangleCullMode::FrontFaceCulling;
+			default:
+				return TriangleCullMode::NoCulling;
+			}
+		}
+
+		//Turns a run time cull mode into a compile time one, function gets a std::integral_constant holding it
+		template<typename Function>
+		inline decltype(auto) DispatchCullMode(TriangleCullMode cullMode, const Function& function)
+		{
+			switch (cullMode)
+			{
+			case TriangleCullMode::FrontFaceCulling:
+				return function(std::integral_constant<TriangleCullMode, TriangleCullMode::FrontFaceCulling>{});
+			case TriangleCullMode::BackFaceCulling:
+				return function(std::integral_constant<TriangleCullMode, TriangleCullMode::BackFaceCulling>{});
+			default:
+				return function(std::integral_constant<TriangleCullMode, TriangleCullMode::NoCulling>{});
+			}
+		}
 
 #pragma region Sphere HitTest
 		//SPHERE HIT-TESTS
-		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		template<HitQuery query>
+		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord)
 		{
+			RayStatistics::Add(RayStatistics::Counter::SphereTests);
+
 			//Analytic
 			//const Vector3 originVector{ ray.origin - sphere.origin };
 			////at + bt + c = 0
@@ -36,7 +82,7 @@ namespace dae
 			//	}
 			//	if (t < ray.max)
 			//	{
-			//		if (!ignoreHitRecord)
+			//		if constexpr (query == HitQuery::ClosestHit)
 			//		{
 			//			hitRecord.didHit = true;
 			//			hitRecord.materialIndex = sphere.materialIndex;
@@ -60,7 +106,7 @@ namespace dae
 			const float t{ originVectorMagnitudeProjected - distancePointIntersection };
 
 			if (t < ray.min || t > ray.max) return false;
-			if (ignoreHitRecord) return true;
+			if constexpr (query == HitQuery::AnyHit) return true;
 				
 			hitRecord.didHit = true;
 			hitRecord.materialIndex = sphere.materialIndex;
@@ -71,20 +117,55 @@ namespace dae
 			return true;
 		}
 
+		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray, HitRecord& hitRecord)
+		{
+			return HitTest_Sphere<HitQuery::ClosestHit>(sphere, ray, hitRecord);
+		}
+
 		inline bool HitTest_Sphere(const Sphere& sphere, const Ray& ray)
 		{
 			HitRecord temp{};
-			return HitTest_Sphere(sphere, ray, temp, true);
+			return HitTest_Sphere<HitQuery::AnyHit>(sphere, ray, temp);
+		}
+
+		//Geometric sphere hittest for all rays of a packet, the terms depending on the shared origin are only calculated once.
+		//Only hits closer than the t already in the hitrecords are accepted.
+		inline void HitTest_Sphere(const Sphere& sphere, const RayPacket& packet, HitRecord* pHitRecords)
+		{
+			RayStatistics::Add(RayStatistics::Counter::SphereTests, packet.GetSize());
+
+			const Vector3 originVector{ sphere.origin - packet.origin };
+			const float originVectorSqr{ originVector.SqrMagnitude() };
+			const float radiusSqr{ Square(sphere.radius) };
+			for (unsigned int rayIdx{}; rayIdx < packet.GetSize(); ++rayIdx)
+			{
+				const float originVectorMagnitudeProjected{ packet.directionX[rayIdx] * originVector.x + packet.directionY[rayIdx] * originVector.y + packet.directionZ[rayIdx] * originVector.z };
+				const float originVectorPerpendicular{ originVectorSqr - Square(originVectorMagnitudeProjected) };
+				if (radiusSqr < originVectorPerpendicular) continue;
+
+				const float t{ originVectorMagnitudeProjected - sqrtf(radiusSqr - originVectorPerpendicular) };
+				HitRecord& hitRecord{ pHitRecords[rayIdx] };
+				if (!(t >= packet.min && t < hitRecord.t)) continue;
+
+				hitRecord.didHit = true;
+				hitRecord.materialIndex = sphere.materialIndex;
+				hitRecord.origin = packet.origin + t * packet.GetDirection(rayIdx);
+				hitRecord.normal = (hitRecord.origin - sphere.origin).Normalized();
+				hitRecord.t = t;
+			}
 		}
 #pragma endregion
 #pragma region Plane HitTest
 		//PLANE HIT-TESTS
-		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		template<HitQuery query>
+		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord)
 		{
+			RayStatistics::Add(RayStatistics::Counter::PlaneTests);
+
 			const float t = Vector3::Dot(plane.origin - ray.origin, plane.normal) / Vector3::Dot(ray.direction, plane.normal);
 			if (t >= ray.min && t < ray.max)
 			{
-				if (!ignoreHitRecord)
+				if constexpr (query == HitQuery::ClosestHit)
 				{
 					hitRecord.didHit = true;
 					hitRecord.materialIndex = plane.materialIndex;
@@ -97,51 +178,64 @@ namespace dae
 			return false;
 		}
 
+		inline bool HitTest_Plane(const Plane& plane, const Ray& ray, HitRecord& hitRecord)
+		{
+			return HitTest_Plane<HitQuery::ClosestHit>(plane, ray, hitRecord);
+		}
+
 		inline bool HitTest_Plane(const Plane& plane, const Ray& ray)
 		{
 			HitRecord temp{};
-			return HitTest_Plane(plane, ray, temp, true);
+			return HitTest_Plane<HitQuery::AnyHit>(plane, ray, temp);
+		}
+
+		//Plane hittest for all rays of a packet, only hits closer than the t already in the hitrecords are accepted
+		inline void HitTest_Plane(const Plane& plane, const RayPacket& packet, HitRecord* pHitRecords)
+		{
+			RayStatistics::Add(RayStatistics::Counter::PlaneTests, packet.GetSize());
+
+			const float originDistance{ Vector3::Dot(plane.origin - packet.origin, plane.normal) };
+			for (unsigned int rayIdx{}; rayIdx < packet.GetSize(); ++rayIdx)
+			{
+				const float t{ originDistance / (packet.directionX[rayIdx] * plane.normal.x + packet.directionY[rayIdx] * plane.normal.y + packet.directionZ[rayIdx] * plane.normal.z) };
+				HitRecord& hitRecord{ pHitRecords[rayIdx] };
+				if (!(t >= packet.min && t < hitRecord.t)) continue;
+
+				hitRecord.didHit = true;
+				hitRecord.materialIndex = plane.materialIndex;
+				hitRecord.normal = plane.normal;
+				hitRecord.origin = packet.origin + t * packet.GetDirection(rayIdx);
+				hitRecord.t = t;
+			}
 		}
 #pragma endregion
 #pragma region Triangle HitTest
 		//TRIANGLE HIT-TESTS
 		
-		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		template<HitQuery query, TriangleCullMode cullMode>
+		inline bool HitTest_Triangle(const BakedTriangle& triangle, unsigned char materialIndex, const Ray& ray, HitRecord& hitRecord)
 		{
+			RayStatistics::Add(RayStatistics::Counter::TriangleTests);
+
 			const float cullDot{ Vector3::Dot(triangle.normal, ray.direction) };
 			if (abs(cullDot) < FLT_EPSILON) return false;
 
-			//Invert cullmode for shadow casting
-			TriangleCullMode cullMode = triangle.cullMode;
-			if (ignoreHitRecord)
-			{
-				switch (cullMode)
-				{
-				case TriangleCullMode::FrontFaceCulling:
-					cullMode = TriangleCullMode::BackFaceCulling;
-					break;
-				case TriangleCullMode::BackFaceCulling:
-					cullMode = TriangleCullMode::FrontFaceCulling;
-					break;
-				}
-			}
-
-			switch (cullMode)
+			constexpr TriangleCullMode queryCullMode{ GetQueryCullMode(query, cullMode) };
+			if constexpr (queryCullMode == TriangleCullMode::FrontFaceCulling)
 			{
-			case TriangleCullMode::FrontFaceCulling:
 				if (cullDot < 0)
 					return false;
-				break;
-			case TriangleCullMode::BackFaceCulling:
+			}
+			else if constexpr (queryCullMode == TriangleCullMode::BackFaceCulling)
+			{
 				if (cullDot > 0)
 					return false;
-				break;
 			}
 
 			//Mller Trumbore algorithm
 			//Source: https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
-			Vector3 edge1{ triangle.v1 - triangle.v0 };
-			Vector3 edge2{ triangle.v2 - triangle.v0 };
+			const Vector3& edge1{ triangle.edge1 };
+			const Vector3& edge2{ triangle.edge2 };
 			Vector3 h{ Vector3::Cross(ray.direction, edge2) };
 
 			float a{ Vector3::Dot(edge1, h) };
@@ -171,9 +265,9 @@ namespace dae
 			if (Vector3::Dot(triangle.normal, Vector3::Cross(triangle.v2 - triangle.v1, intersectionPoint - triangle.v1)) < 0) return false;
 			if (Vector3::Dot(triangle.normal, Vector3::Cross(triangle.v0 - triangle.v2, intersectionPoint - triangle.v2)) < 0) return false;*/
 			
-			if (!ignoreHitRecord)
+			if constexpr (query == HitQuery::ClosestHit)
 			{
-				hitRecord.materialIndex = triangle.materialIndex;
+				hitRecord.materialIndex = materialIndex;
 				hitRecord.didHit = true;
 				hitRecord.normal = triangle.normal;
 				hitRecord.origin = intersectionPoint;
@@ -183,10 +277,112 @@ namespace dae
 			return true;
 		}
 
+		//Picks the kernel for the cull mode on every call, loops over many triangles should pick it once instead
+		template<HitQuery query>
+		inline bool HitTest_Triangle(const BakedTriangle& triangle, TriangleCullMode cullMode, unsigned char materialIndex, const Ray& ray, HitRecord& hitRecord)
+		{
+			return DispatchCullMode(cullMode, [&](auto meshCullMode)
+				{
+					return HitTest_Triangle<query, decltype(meshCullMode)::value>(triangle, materialIndex, ray, hitRecord);
+				});
+		}
+
+		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray, HitRecord& hitRecord)
+		{
+			const BakedTriangle bakedTriangle{ triangle.v0, triangle.v1, triangle.v2, triangle.normal };
+			return HitTest_Triangle<HitQuery::ClosestHit>(bakedTriangle, triangle.cullMode, triangle.materialIndex, ray, hitRecord);
+		}
+
 		inline bool HitTest_Triangle(const Triangle& triangle, const Ray& ray)
 		{
 			HitRecord temp{};
-			return HitTest_Triangle(triangle, ray, temp, true);
+			const BakedTriangle bakedTriangle{ triangle.v0, triangle.v1, triangle.v2, triangle.normal };
+			return HitTest_Triangle<HitQuery::AnyHit>(bakedTriangle, triangle.cullMode, triangle.materialIndex, ray, temp);
+		}
+
+		//Moller Trumbore on a packet of triangles at once (SSE), with the same culling rules as HitTest_Triangle.
+		//Only hits closer than hitRecord.t are accepted, the nearest lane is written to the hitrecord.
+		template<HitQuery query, TriangleCullMode cullMode>
+		inline bool HitTest_TrianglePacket(const TrianglePacket& packet, unsigned char materialIndex, const Ray& ray, HitRecord& hitRecord)
+		{
+			RayStatistics::Add(RayStatistics::Counter::TriangleTests, TrianglePacket::width);
+
+			const __m128 zero{ _mm_setzero_ps() };
+			const __m128 one{ _mm_set1_ps(1.f) };
+			const __m128 epsilon{ _mm_set1_ps(FLT_EPSILON) };
+			const __m128 absMask{ _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)) };
+
+			const __m128 directionX{ _mm_set1_ps(ray.direction.x) };
+			const __m128 directionY{ _mm_set1_ps(ray.direction.y) };
+			const __m128 directionZ{ _mm_set1_ps(ray.direction.z) };
+
+			const __m128 cullDot{ _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(_mm_load_ps(packet.normalX), directionX),
+				_mm_mul_ps(_mm_load_ps(packet.normalY), directionY)),
+				_mm_mul_ps(_mm_load_ps(packet.normalZ), directionZ)) };
+			__m128 isValid{ _mm_cmpge_ps(_mm_and_ps(cullDot, absMask), epsilon) };
+
+			constexpr TriangleCullMode queryCullMode{ GetQueryCullMode(query, cullMode) };
+			if constexpr (queryCullMode == TriangleCullMode::FrontFaceCulling)
+			{
+				isValid = _mm_and_ps(isValid, _mm_cmpge_ps(cullDot, zero));
+			}
+			else if constexpr (queryCullMode == TriangleCullMode::BackFaceCulling)
+			{
+				isValid = _mm_and_ps(isValid, _mm_cmple_ps(cullDot, zero));
+			}
+			if (_mm_movemask_ps(isValid) == 0) return false;
+
+			const __m128 edge1X{ _mm_load_ps(packet.edge1X) };
+			const __m128 edge1Y{ _mm_load_ps(packet.edge1Y) };
+			const __m128 edge1Z{ _mm_load_ps(packet.edge1Z) };
+			const __m128 edge2X{ _mm_load_ps(packet.edge2X) };
+			const __m128 edge2Y{ _mm_load_ps(packet.edge2Y) };
+			const __m128 edge2Z{ _mm_load_ps(packet.edge2Z) };
+
+			//h = direction x edge2
+			const __m128 hX{ _mm_sub_ps(_mm_mul_ps(directionY, edge2Z), _mm_mul_ps(directionZ, edge2Y)) };
+			const __m128 hY{ _mm_sub_ps(_mm_mul_ps(directionZ, edge2X), _mm_mul_ps(directionX, edge2Z)) };
+			const __m128 hZ{ _mm_sub_ps(_mm_mul_ps(directionX, edge2Y), _mm_mul_ps(directionY, edge2X)) };
+
+			const __m128 a{ _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge1X, hX), _mm_mul_ps(edge1Y, hY)), _mm_mul_ps(edge1Z, hZ)) };
+			isValid = _mm_and_ps(isValid, _mm_cmpge_ps(_mm_and_ps(a, absMask), epsilon));
+
+			const __m128 aInverse{ _mm_div_ps(one, a) };
+			const __m128 sX{ _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_load_ps(packet.v0X)) };
+			const __m128 sY{ _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_load_ps(packet.v0Y)) };
+			const __m128 sZ{ _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_load_ps(packet.v0Z)) };
+			const __m128 u{ _mm_mul_ps(aInverse, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sX, hX), _mm_mul_ps(sY, hY)), _mm_mul_ps(sZ, hZ))) };
+			isValid = _mm_and_ps(isValid, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+
+			//q = s x edge1
+			const __m128 qX{ _mm_sub_ps(_mm_mul_ps(sY, edge1Z), _mm_mul_ps(sZ, edge1Y)) };
+			const __m128 qY{ _mm_sub_ps(_mm_mul_ps(sZ, edge1X), _mm_mul_ps(sX, edge1Z)) };
+			const __m128 qZ{ _mm_sub_ps(_mm_mul_ps(sX, edge1Y), _mm_mul_ps(sY, edge1X)) };
+			const __m128 v{ _mm_mul_ps(aInverse, _mm_add_ps(_mm_add_ps(_mm_mul_ps(directionX, qX), _mm_mul_ps(directionY, qY)), _mm_mul_ps(directionZ, qZ))) };
+			isValid = _mm_and_ps(isValid, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+
+			const __m128 t{ _mm_mul_ps(aInverse, _mm_add_ps(_mm_add_ps(_mm_mul_ps(edge2X, qX), _mm_mul_ps(edge2Y, qY)), _mm_mul_ps(edge2Z, qZ))) };
+			isValid = _mm_and_ps(isValid, _mm_and_ps(_mm_cmpge_ps(t, _mm_set1_ps(ray.min)), _mm_cmplt_ps(t, _mm_set1_ps(std::min(ray.max, hitRecord.t)))));
+
+			const int hitMask{ _mm_movemask_ps(isValid) };
+			if (hitMask == 0) return false;
+			if constexpr (query == HitQuery::AnyHit) return true;
+
+			//Find the nearest lane
+			const __m128 hitT{ _mm_or_ps(_mm_and_ps(isValid, t), _mm_andnot_ps(isValid, _mm_set1_ps(FLT_MAX))) };
+			__m128 minT{ _mm_min_ps(hitT, _mm_shuffle_ps(hitT, hitT, _MM_SHUFFLE(2, 3, 0, 1))) };
+			minT = _mm_min_ps(minT, _mm_shuffle_ps(minT, minT, _MM_SHUFFLE(1, 0, 3, 2)));
+			const int lane{ std::countr_zero(static_cast<unsigned int>(_mm_movemask_ps(_mm_cmpeq_ps(hitT, minT)) & hitMask)) };
+
+			const float nearestT{ _mm_cvtss_f32(minT) };
+			hitRecord.materialIndex = materialIndex;
+			hitRecord.didHit = true;
+			hitRecord.normal = { packet.normalX[lane], packet.normalY[lane], packet.normalZ[lane] };
+			hitRecord.origin = ray.origin + nearestT * ray.direction;
+			hitRecord.t = nearestT;
+
+			return true;
 		}
 #pragma endregion
 #pragma region TriangeMesh HitTest
@@ -218,8 +414,11 @@ namespace dae
 		//BVH algorithm taken from: https://jacco.ompf2.com/2022/04/13/how-to-build-a-bvh-part-1-basics/
 		//Part 2: https://jacco.ompf2.com/2022/04/18/how-to-build-a-bvh-part-2-faster-rays/
 		//Part 3: https://jacco.ompf2.com/2022/04/21/how-to-build-a-bvh-part-3-quick-builds/
-		inline bool SlabTest_BVH(const Vector3& minAABB, const Vector3& maxAABB, const Ray& ray)
+		//Returns the distance at which the ray enters the box, or FLT_MAX if it misses or enters beyond maxDistance
+		inline float SlabTest_BVH(const Vector3& minAABB, const Vector3& maxAABB, const Ray& ray, float maxDistance = FLT_MAX)
 		{
+			RayStatistics::Add(RayStatistics::Counter::SlabTests);
+
 			//BVH AABB slabtest with inversed direction in ray
 			float tx1 = (minAABB.x - ray.origin.x) * ray.inversedDir.x;
 			float tx2 = (maxAABB.x - ray.origin.x) * ray.inversedDir.x;
@@ -239,97 +438,516 @@ namespace dae
 			tMin = std::max(tMin, std::min(tz1, tz2));
 			tMax = std::min(tMax, std::max(tz1, tz2));
 
-			return tMax > 0 && tMax >= tMin;
+			if (tMax > 0 && tMax >= tMin && tMin < maxDistance) return tMin;
+			return FLT_MAX;
 		}
 
-
-		inline void IntersectionTest_BVH(const TriangleMesh& mesh, unsigned int nodeIdx, const Ray& ray, bool& didHit, HitRecord& hitRecord, HitRecord& currentRecord, bool ignoreHitRecord)
+		//Tests all triangles of a leaf, any hit queries return on the first hit
+		template<HitQuery query, TriangleCullMode cullMode>
+		inline bool IntersectionTest_Leaf(const TriangleMesh& mesh, unsigned int firstIdx, unsigned int idxCount, const Ray& ray, HitRecord& hitRecord, [[maybe_unused]] HitRecord& currentRecord)
 		{
-			
-			BVHNode& node{ mesh.pBVHNodes[nodeIdx] };
-			//Test if ray intersects the node's bounding box
-			if (!SlabTest_BVH(node.minAABB, node.maxAABB, ray))
+			bool didHit{};
+#ifdef USE_TRIANGLE_PACKETS
+			//Leaves are a contiguous range of triangle packets
+			const unsigned int packetCount{ (idxCount / 3 + TrianglePacket::width - 1) / TrianglePacket::width };
+			const TrianglePacket* pPacket{ mesh.trianglePackets.data() + mesh.leafPacketIdx[firstIdx / 3] };
+			for (unsigned int packetIdx{}; packetIdx < packetCount; ++packetIdx, ++pPacket)
 			{
-				return;
+				if (HitTest_TrianglePacket<query, cullMode>(*pPacket, mesh.materialIndex, ray, hitRecord))
+				{
+					didHit = true;
+					if constexpr (query == HitQuery::AnyHit) return true;
+				}
 			}
-
-			//If the node is a leaf, run the hittest code
-			if (node.IsLeaf())
+#else
+			//Leaves are a contiguous range in the baked triangle buffer
+			const BakedTriangle* pTriangle{ mesh.bakedTriangles.data() + firstIdx / 3 };
+			const BakedTriangle* pLastTriangle{ pTriangle + idxCount / 3 };
+			for (; pTriangle != pLastTriangle; ++pTriangle)
 			{
-				Triangle triangle{};
-				triangle.materialIndex = mesh.materialIndex;
-				triangle.cullMode = mesh.cullMode;
-				for (int idx{}; idx < static_cast<int>(node.idxCount); idx += 3)
+				if (HitTest_Triangle<query, cullMode>(*pTriangle, mesh.materialIndex, ray, currentRecord))
 				{
-					int leafIdx{ static_cast<int>(node.firstIdx) + idx };
-					triangle.v0 = mesh.transformedPositions[mesh.indices[leafIdx]];
-					triangle.v1 = mesh.transformedPositions[mesh.indices[leafIdx + 1]];
-					triangle.v2 = mesh.transformedPositions[mesh.indices[leafIdx + 2]];
-					triangle.normal = mesh.transformedNormals[leafIdx / 3];
+					didHit = true;
+					if constexpr (query == HitQuery::AnyHit) return true;
+					if (currentRecord.t < hitRecord.t)
+					{
+						hitRecord = currentRecord;
+					}
+				}
+			}
+#endif
+			return didHit;
+		}
 
+		//Stack based traversal: the nearest child is visited first and nodes entered beyond the closest hit are skipped.
+		//For any hit queries the first hit ends the traversal (shadow rays).
+		//The profiling instantiation also counts the visits of every node into pNodeVisits, indexed like bvhNodes.
+		template<HitQuery query, TriangleCullMode cullMode, bool profileNodes = false>
+		inline bool IntersectionTest_BVH(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, unsigned int* pNodeVisits = nullptr)
+		{
+			if (mesh.bvhNodes.empty()) return false;
+
+			const BVHNode* pNodes{ mesh.bvhNodes.data() };
+			const BVHNode* pNode{ &pNodes[mesh.rootNodeIdx] };
+			if (SlabTest_BVH(pNode->minAABB, pNode->maxAABB, ray, std::min(ray.max, hitRecord.t)) == FLT_MAX) return false;
 
-					if (HitTest_Triangle(triangle, ray, currentRecord, ignoreHitRecord))
+			HitRecord currentRecord{};
+			bool didHit{};
+
+			const BVHNode* nodeStack[maxBVHDepth];
+			float distanceStack[maxBVHDepth];
+			int stackSize{};
+			while (true)
+			{
+				if constexpr (profileNodes) ++pNodeVisits[pNode - pNodes];
+				RayStatistics::Add(RayStatistics::Counter::BVHNodes);
+
+				//If the node is a leaf, run the hittest code
+				if (pNode->IsLeaf())
+				{
+					if (IntersectionTest_Leaf<query, cullMode>(mesh, pNode->leftFirst, pNode->idxCount, ray, hitRecord, currentRecord))
 					{
 						didHit = true;
-						if (ignoreHitRecord) return;
-						if (currentRecord.t < hitRecord.t)
+						if constexpr (query == HitQuery::AnyHit) return true;
+					}
+				}
+				else
+				{
+					//Test both children and continue with the nearest one
+					const float maxDistance{ std::min(ray.max, hitRecord.t) };
+					const BVHNode* pNearChild{ &pNodes[pNode->leftFirst] };
+					const BVHNode* pFarChild{ &pNodes[pNode->leftFirst + 1] };
+					float nearDistance{ SlabTest_BVH(pNearChild->minAABB, pNearChild->maxAABB, ray, maxDistance) };
+					float farDistance{ SlabTest_BVH(pFarChild->minAABB, pFarChild->maxAABB, ray, maxDistance) };
+					if (nearDistance > farDistance)
+					{
+						std::swap(nearDistance, farDistance);
+						std::swap(pNearChild, pFarChild);
+					}
+
+					if (nearDistance != FLT_MAX)
+					{
+						if (farDistance != FLT_MAX)
 						{
-							hitRecord = currentRecord;
+							assert(stackSize < static_cast<int>(maxBVHDepth));
+							nodeStack[stackSize] = pFarChild;
+							distanceStack[stackSize] = farDistance;
+							++stackSize;
 						}
+						pNode = pNearChild;
+						continue;
 					}
 				}
+
+				//Pop the next node, skipping the ones entered beyond the closest hit found since they were pushed
+				pNode = nullptr;
+				while (stackSize > 0 && !pNode)
+				{
+					--stackSize;
+					if (distanceStack[stackSize] < hitRecord.t)
+					{
+						pNode = nodeStack[stackSize];
+					}
+				}
+				if (!pNode) break;
 			}
-			else
+			return didHit;
+		}
+
+		//Slab tests 4 children of a wide node starting at offset, returns a bitmask of the children that were hit
+		template<int Width>
+		inline int SlabTest_WideBVH_SSE(const WideBVHNode<Width>& node, int offset, const __m128* pOrigin, const __m128* pInversedDir, __m128 maxDistance, float* pDistances)
+		{
+			RayStatistics::Add(RayStatistics::Counter::SlabTests, 4);
+
+			const __m128 tx1{ _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minX + offset), pOrigin[0]), pInversedDir[0]) };
+			const __m128 tx2{ _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxX + offset), pOrigin[0]), pInversedDir[0]) };
+			__m128 tMin{ _mm_min_ps(tx1, tx2) };
+			__m128 tMax{ _mm_max_ps(tx1, tx2) };
+
+			const __m128 ty1{ _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minY + offset), pOrigin[1]), pInversedDir[1]) };
+			const __m128 ty2{ _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxY + offset), pOrigin[1]), pInversedDir[1]) };
+			tMin = _mm_max_ps(tMin, _mm_min_ps(ty1, ty2));
+			tMax = _mm_min_ps(tMax, _mm_max_ps(ty1, ty2));
+
+			const __m128 tz1{ _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.minZ + offset), pOrigin[2]), pInversedDir[2]) };
+			const __m128 tz2{ _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxZ + offset), pOrigin[2]), pInversedDir[2]) };
+			tMin = _mm_max_ps(tMin, _mm_min_ps(tz1, tz2));
+			tMax = _mm_min_ps(tMax, _mm_max_ps(tz1, tz2));
+
+			_mm_storeu_ps(pDistances + offset, tMin);
+			const __m128 hitMask{ _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(tMax, _mm_setzero_ps()), _mm_cmpge_ps(tMax, tMin)), _mm_cmplt_ps(tMin, maxDistance)) };
+			return _mm_movemask_ps(hitMask) << offset;
+		}
+
+#ifdef __AVX__
+		inline int SlabTest_WideBVH_AVX(const WideBVHNode<8>& node, const __m256* pOrigin, const __m256* pInversedDir, __m256 maxDistance, float* pDistances)
+		{
+			RayStatistics::Add(RayStatistics::Counter::SlabTests, 8);
+
+			const __m256 tx1{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minX), pOrigin[0]), pInversedDir[0]) };
+			const __m256 tx2{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxX), pOrigin[0]), pInversedDir[0]) };
+			__m256 tMin{ _mm256_min_ps(tx1, tx2) };
+			__m256 tMax{ _mm256_max_ps(tx1, tx2) };
+
+			const __m256 ty1{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minY), pOrigin[1]), pInversedDir[1]) };
+			const __m256 ty2{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxY), pOrigin[1]), pInversedDir[1]) };
+			tMin = _mm256_max_ps(tMin, _mm256_min_ps(ty1, ty2));
+			tMax = _mm256_min_ps(tMax, _mm256_max_ps(ty1, ty2));
+
+			const __m256 tz1{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.minZ), pOrigin[2]), pInversedDir[2]) };
+			const __m256 tz2{ _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.maxZ), pOrigin[2]), pInversedDir[2]) };
+			tMin = _mm256_max_ps(tMin, _mm256_min_ps(tz1, tz2));
+			tMax = _mm256_min_ps(tMax, _mm256_max_ps(tz1, tz2));
+
+			_mm256_storeu_ps(pDistances, tMin);
+			const __m256 hitMask{ _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(tMax, _mm256_setzero_ps(), _CMP_GT_OQ), _mm256_cmp_ps(tMax, tMin, _CMP_GE_OQ)), _mm256_cmp_ps(tMin, maxDistance, _CMP_LT_OQ)) };
+			return _mm256_movemask_ps(hitMask);
+		}
+#endif
+
+		//Traversal of the collapsed BVH4 (SSE) or BVH8 (AVX, or two SSE passes when AVX is not enabled).
+		//Hit children are pushed far to near so the nearest one is processed first.
+		template<int Width, HitQuery query, TriangleCullMode cullMode>
+		inline bool IntersectionTest_WideBVH(const TriangleMesh& mesh, const std::vector<WideBVHNode<Width>>& wideNodes, const Ray& ray, HitRecord& hitRecord)
+		{
+			static_assert(Width == 4 || Width == 8, "Only BVH4 and BVH8 are supported");
+			if (wideNodes.empty()) return false;
+
+			HitRecord currentRecord{};
+			bool didHit{};
+
+			const __m128 origin[3]{ _mm_set1_ps(ray.origin.x), _mm_set1_ps(ray.origin.y), _mm_set1_ps(ray.origin.z) };
+			const __m128 inversedDir[3]{ _mm_set1_ps(ray.inversedDir.x), _mm_set1_ps(ray.inversedDir.y), _mm_set1_ps(ray.inversedDir.z) };
+#ifdef __AVX__
+			const __m256 originWide[3]{ _mm256_set1_ps(ray.origin.x), _mm256_set1_ps(ray.origin.y), _mm256_set1_ps(ray.origin.z) };
+			const __m256 inversedDirWide[3]{ _mm256_set1_ps(ray.inversedDir.x), _mm256_set1_ps(ray.inversedDir.y), _mm256_set1_ps(ray.inversedDir.z) };
+#endif
+
+			struct StackEntry
+			{
+				unsigned int child;
+				unsigned int idxCount;
+				float distance;
+			};
+			//A wide node leaves at most Width - 1 children pending per level
+			constexpr int stackCapacity{ (Width - 1) * static_cast<int>(maxBVHDepth) + 1 };
+			StackEntry stack[stackCapacity];
+			int stackSize{};
+			stack[stackSize++] = { 0, 0, 0.f };
+
+			float distances[Width];
+			while (stackSize > 0)
 			{
-				//Run intersectiontest on children if node is not a leaf
-				IntersectionTest_BVH(mesh, node.leftNode, ray, didHit, hitRecord, currentRecord, ignoreHitRecord);
-				IntersectionTest_BVH(mesh, node.leftNode + 1, ray, didHit, hitRecord, currentRecord, ignoreHitRecord);
+				const StackEntry entry{ stack[--stackSize] };
+				const float maxDistance{ std::min(ray.max, hitRecord.t) };
+				if (entry.distance >= maxDistance) continue;
+				RayStatistics::Add(RayStatistics::Counter::BVHNodes);
+
+				if (entry.idxCount > 0)
+				{
+					if (IntersectionTest_Leaf<query, cullMode>(mesh, entry.child, entry.idxCount, ray, hitRecord, currentRecord))
+					{
+						didHit = true;
+						if constexpr (query == HitQuery::AnyHit) return true;
+					}
+					continue;
+				}
+
+				const WideBVHNode<Width>& node{ wideNodes[entry.child] };
+				int hitMask{};
+				if constexpr (Width == 4)
+				{
+					hitMask = SlabTest_WideBVH_SSE(node, 0, origin, inversedDir, _mm_set1_ps(maxDistance), distances);
+				}
+				else
+				{
+#ifdef __AVX__
+					hitMask = SlabTest_WideBVH_AVX(node, originWide, inversedDirWide, _mm256_set1_ps(maxDistance), distances);
+#else
+					hitMask = SlabTest_WideBVH_SSE(node, 0, origin, inversedDir, _mm_set1_ps(maxDistance), distances) |
+						SlabTest_WideBVH_SSE(node, 4, origin, inversedDir, _mm_set1_ps(maxDistance), distances);
+#endif
+				}
+				hitMask &= (1 << node.childCount) - 1;
+
+				//Insertion sort on the pushed entries, keeping the nearest child on top of the stack
+				const int firstEntry{ stackSize };
+				while (hitMask)
+				{
+					const int childIdx{ std::countr_zero(static_cast<unsigned int>(hitMask)) };
+					hitMask &= hitMask - 1;
+
+					const StackEntry newEntry{ node.child[childIdx], node.idxCount[childIdx], distances[childIdx] };
+					assert(stackSize < stackCapacity);
+					int insertIdx{ stackSize++ };
+					while (insertIdx > firstEntry && stack[insertIdx - 1].distance < newEntry.distance)
+					{
+						stack[insertIdx] = stack[insertIdx - 1];
+						--insertIdx;
+					}
+					stack[insertIdx] = newEntry;
+				}
 			}
+			return didHit;
 		}
 
-		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, bool ignoreHitRecord = false)
+		//Object space query of a mesh with its cull mode known at compile time
+		template<HitQuery query, TriangleCullMode cullMode>
+		inline bool IntersectionTest_TriangleMesh(const TriangleMesh& mesh, const Ray& objectRay, HitRecord& objectHit)
 		{
-			
-			HitRecord closestHit{};
-			bool didHit{ };
 			//Run bvh if enabled, otherwise run the hittest directly
 #ifdef BVH
-			IntersectionTest_BVH(mesh, 0, ray, didHit, hitRecord, closestHit, ignoreHitRecord);
+			switch (mesh.bvhLayout)
+			{
+			case BVHLayout::Wide4:
+				return IntersectionTest_WideBVH<4, query, cullMode>(mesh, mesh.bvh4Nodes, objectRay, objectHit);
+			case BVHLayout::Wide8:
+				return IntersectionTest_WideBVH<8, query, cullMode>(mesh, mesh.bvh8Nodes, objectRay, objectHit);
+			default:
+				return IntersectionTest_BVH<query, cullMode>(mesh, objectRay, objectHit);
+			}
 #else
+			HitRecord closestHit{};
+			bool didHit{};
+			for (const BakedTriangle& triangle : mesh.bakedTriangles)
+			{
+				if (HitTest_Triangle<query, cullMode>(triangle, mesh.materialIndex, objectRay, closestHit))
+				{
+					if constexpr (query == HitQuery::AnyHit) return true;
+					if (closestHit.t < objectHit.t)
+					{
+						objectHit = closestHit;
+					}
+					didHit = true;
+				}
+			}
+			return didHit;
+#endif
+		}
+
+		//Profiling queries always traverse the binary BVH and count its node visits into pNodeVisits
+		template<HitQuery query, bool profileNodes = false>
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord, unsigned int* pNodeVisits = nullptr)
+		{
+#ifndef BVH
 			//Check if the ray intersects with the boundingbox
 			if (!SlabTest_TriangleMesh(mesh, ray))
 			{
 				return false;
 			}
-			Triangle triangle{};
-			triangle.materialIndex = mesh.materialIndex;
-			triangle.cullMode = mesh.cullMode;
-			for (int idx{}; idx < mesh.indices.size(); idx += 3)
-			{
-				triangle.v0 = mesh.transformedPositions[mesh.indices[idx]];
-				triangle.v1 = mesh.transformedPositions[mesh.indices[idx + 1]];
-				triangle.v2 = mesh.transformedPositions[mesh.indices[idx + 2]];
-				triangle.normal = mesh.transformedNormals[idx / 3];
+#endif
+			//Transform the ray into object space instead of transforming the mesh.
+			//The direction is not normalized, so t stays the same distance along the world ray.
+			const Ray objectRay{ mesh.inverseTransform.TransformPoint(ray.origin), mesh.inverseTransform.TransformVector(ray.direction), ray.min, ray.max };
 
-
-				if (HitTest_Triangle(triangle, ray, closestHit, ignoreHitRecord))
+			//The cull mode is resolved once per mesh, every triangle test below uses the kernel specialized for it.
+			//t is the same in both spaces, so the traversal can start from the closest hit so far and skip everything behind it.
+			HitRecord objectHit{};
+			objectHit.t = hitRecord.t;
+			const bool didHit{ DispatchCullMode(mesh.cullMode, [&](auto cullMode)
 				{
-					if (ignoreHitRecord) return true;
-					if (closestHit.t < hitRecord.t)
+					if constexpr (profileNodes)
 					{
-						hitRecord = closestHit;
+						return IntersectionTest_BVH<query, decltype(cullMode)::value, true>(mesh, objectRay, objectHit, pNodeVisits);
 					}
-					didHit = true;
-				}
+					else
+					{
+						return IntersectionTest_TriangleMesh<query, decltype(cullMode)::value>(mesh, objectRay, objectHit);
+					}
+				}) };
+			if constexpr (query == HitQuery::AnyHit) return didHit;
+
+			//Bring the closest hit back to world space, only hits closer than the one passed in were accepted
+			if (didHit && objectHit.t < hitRecord.t)
+			{
+				hitRecord = objectHit;
+				hitRecord.origin = ray.origin + objectHit.t * ray.direction;
+				hitRecord.normal = mesh.normalTransform.TransformVector(objectHit.normal).Normalized();
 			}
-#endif			
 			return didHit;
 		}
 
+		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray, HitRecord& hitRecord)
+		{
+			return HitTest_TriangleMesh<HitQuery::ClosestHit>(mesh, ray, hitRecord);
+		}
+
 		inline bool HitTest_TriangleMesh(const TriangleMesh& mesh, const Ray& ray)
 		{
 			HitRecord temp{};
-			return HitTest_TriangleMesh(mesh, ray, temp, true);
+			return HitTest_TriangleMesh<HitQuery::AnyHit>(mesh, ray, temp);
+		}
+
+		//Conservative: false only when the box lies completely outside one of the frustum planes of the packet
+		inline bool FrustumTest_AABB(const RayPacket& packet, const Vector3& minAABB, const Vector3& maxAABB)
+		{
+			for (const Vector3& normal : packet.frustumNormals)
+			{
+				//Corner of the box furthest along the normal
+				const Vector3 corner{
+					normal.x >= 0.f ? maxAABB.x : minAABB.x,
+					normal.y >= 0.f ? maxAABB.y : minAABB.y,
+					normal.z >= 0.f ? maxAABB.z : minAABB.z };
+				if (Vector3::Dot(normal, corner - packet.origin) < 0.f) return false;
+			}
+			return true;
+		}
+
+		//Lower bound of the distance along any ray of the packet at which it can enter the box
+		inline float GetEntryDistance(const RayPacket& packet, const Vector3& minAABB, const Vector3& maxAABB)
+		{
+			const Vector3 offset{ Vector3::Max(Vector3::Max(minAABB - packet.origin, packet.origin - maxAABB), Vector3::Zero) };
+			return offset.Magnitude() / packet.maxDirectionLength;
+		}
+
+		//Slab tests 4 rays of the packet starting at firstRay against a box, returns a bitmask of the rays that enter it
+		//before their maxDistance
+		inline int SlabTest_RayPacket_SSE(const RayPacket& packet, unsigned int firstRay, const Vector3& minAABB, const Vector3& maxAABB, const float* pMaxDistances)
+		{
+			RayStatistics::Add(RayStatistics::Counter::SlabTests, 4);
+
+			const __m128 inversedDirX{ _mm_load_ps(packet.inversedDirX + firstRay) };
+			const __m128 inversedDirY{ _mm_load_ps(packet.inversedDirY + firstRay) };
+			const __m128 inversedDirZ{ _mm_load_ps(packet.inversedDirZ + firstRay) };
+
+			const __m128 tx1{ _mm_mul_ps(_mm_set1_ps(minAABB.x - packet.origin.x), inversedDirX) };
+			const __m128 tx2{ _mm_mul_ps(_mm_set1_ps(maxAABB.x - packet.origin.x), inversedDirX) };
+			const __m128 ty1{ _mm_mul_ps(_mm_set1_ps(minAABB.y - packet.origin.y), inversedDirY) };
+			const __m128 ty2{ _mm_mul_ps(_mm_set1_ps(maxAABB.y - packet.origin.y), inversedDirY) };
+			const __m128 tz1{ _mm_mul_ps(_mm_set1_ps(minAABB.z - packet.origin.z), inversedDirZ) };
+			const __m128 tz2{ _mm_mul_ps(_mm_set1_ps(maxAABB.z - packet.origin.z), inversedDirZ) };
+
+			const __m128 tMin{ _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), _mm_min_ps(tz1, tz2)) };
+			const __m128 tMax{ _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), _mm_max_ps(tz1, tz2)) };
+
+			const __m128 isHit{ _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(tMax, _mm_setzero_ps()), _mm_cmpge_ps(tMax, tMin)),
+				_mm_cmplt_ps(tMin, _mm_load_ps(pMaxDistances + firstRay))) };
+			return _mm_movemask_ps(isHit);
+		}
+
+		//Packet traversal: every node is tested once for the whole packet against its frustum and against a bound on the
+		//closest hits found so far. Only at the leaves the rays are slab tested (4 at a time) and intersected one by one.
+		//Only hits closer than the t already in the hitrecords are accepted.
+		template<TriangleCullMode cullMode>
+		inline void IntersectionTest_BVH(const TriangleMesh& mesh, const RayPacket& packet, HitRecord* pHitRecords)
+		{
+			if (mesh.bvhNodes.empty()) return;
+
+			const unsigned int size{ packet.GetSize() };
+			alignas(16) float maxDistances[RayPacket::maxSize]{};
+			float packetMaxDistance{};
+			for (unsigned int rayIdx{}; rayIdx < size; ++rayIdx)
+			{
+				maxDistances[rayIdx] = pHitRecords[rayIdx].t;
+				packetMaxDistance = std::max(packetMaxDistance, maxDistances[rayIdx]);
+			}
+
+			//The child closest along the middle of the packet is visited first
+			const Vector3 centralDirection{ packet.GetDirection(0) + packet.GetDirection(size - 1) };
+			const auto getCenterDistance{ [&](const BVHNode& node)
+				{
+					return Vector3::Dot((node.minAABB + node.maxAABB) * 0.5f - packet.origin, centralDirection);
+				} };
+
+			HitRecord currentRecord{};
+			unsigned int nodeStack[maxBVHDepth];
+			int stackSize{};
+			nodeStack[stackSize++] = mesh.rootNodeIdx;
+			while (stackSize > 0)
+			{
+				const BVHNode& node{ mesh.bvhNodes[nodeStack[--stackSize]] };
+				if (GetEntryDistance(packet, node.minAABB, node.maxAABB) >= packetMaxDistance) continue;
+				if (!FrustumTest_AABB(packet, node.minAABB, node.maxAABB)) continue;
+				RayStatistics::Add(RayStatistics::Counter::BVHNodes);
+
+				if (!node.IsLeaf())
+				{
+					unsigned int nearChildIdx{ node.leftFirst };
+					unsigned int farChildIdx{ node.leftFirst + 1 };
+					if (getCenterDistance(mesh.bvhNodes[nearChildIdx]) > getCenterDistance(mesh.bvhNodes[farChildIdx]))
+					{
+						std::swap(nearChildIdx, farChildIdx);
+					}
+					assert(stackSize + 2 <= static_cast<int>(maxBVHDepth));
+					nodeStack[stackSize++] = farChildIdx;
+					nodeStack[stackSize++] = nearChildIdx;
+					continue;
+				}
+
+				for (unsigned int firstRay{}; firstRay < size; firstRay += 4)
+				{
+					int hitMask{ SlabTest_RayPacket_SSE(packet, firstRay, node.minAABB, node.maxAABB, maxDistances) };
+					if (size - firstRay < 4)
+					{
+						hitMask &= (1 << (size - firstRay)) - 1;
+					}
+
+					while (hitMask != 0)
+					{
+						const unsigned int rayIdx{ firstRay + std::countr_zero(static_cast<unsigned int>(hitMask)) };
+						hitMask &= hitMask - 1;
+						if (IntersectionTest_Leaf<HitQuery::ClosestHit, cullMode>(mesh, node.leftFirst, node.idxCount, packet.GetRay(rayIdx), pHitRecords[rayIdx], currentRecord))
+						{
+							maxDistances[rayIdx] = pHitRecords[rayIdx].t;
+						}
+					}
+				}
+
+				packetMaxDistance = 0.f;
+				for (unsigned int rayIdx{}; rayIdx < size; ++rayIdx)
+				{
+					packetMaxDistance = std::max(packetMaxDistance, maxDistances[rayIdx]);
+				}
+			}
+		}
+
+		//Closest hits of a packet against a mesh, a hitrecord is only overwritten by a hit closer than its current t.
+		//Packets always traverse the binary BVH, whatever layout the mesh uses for single rays.
+		inline void HitTest_TriangleMesh(const TriangleMesh& mesh, const RayPacket& packet, HitRecord* pHitRecords)
+		{
+			const unsigned int size{ packet.GetSize() };
+#ifdef BVH
+			//Transform the packet into object space, the directions are not normalized so t stays the same along every ray
+			RayPacket objectPacket{};
+			objectPacket.origin = mesh.inverseTransform.TransformPoint(packet.origin);
+			objectPacket.width = packet.width;
+			objectPacket.height = packet.height;
+			objectPacket.min = packet.min;
+			for (unsigned int rayIdx{}; rayIdx < size; ++rayIdx)
+			{
+				objectPacket.SetDirection(rayIdx, mesh.inverseTransform.TransformVector(packet.GetDirection(rayIdx)));
+			}
+			objectPacket.UpdateFrustum();
+
+			//Start from the closest hits so far so the traversal can skip everything behind them
+			HitRecord objectHits[RayPacket::maxSize];
+			for (unsigned int rayIdx{}; rayIdx < size; ++rayIdx)
+			{
+				objectHits[rayIdx].t = pHitRecords[rayIdx].t;
+			}
+			DispatchCullMode(mesh.cullMode, [&](auto cullMode)
+				{
+					IntersectionTest_BVH<decltype(cullMode)::value>(mesh, objectPacket, objectHits);
+				});
+
+			//Bring the closer hits back to world space
+			for (unsigned int rayIdx{}; rayIdx < size; ++rayIdx)
+			{
+				const HitRecord& objectHit{ objectHits[rayIdx] };
+				if (objectHit.t >= pHitRecords[rayIdx].t) continue;
+
+				HitRecord& hitRecord{ pHitRecords[rayIdx] };
+				hitRecord = objectHit;
+				hitRecord.origin = packet.origin + objectHit.t * packet.GetDirection(rayIdx);
+				hitRecord.normal = mesh.normalTransform.TransformVector(objectHit.normal).Normalized();
+			}
+#else
+			for (unsigned int rayIdx{}; rayIdx < size; ++rayIdx)
+			{
+				HitTest_TriangleMesh(mesh, packet.GetRay(rayIdx), pHitRecords[rayIdx]);
+			}
+#endif
 		}
 
 #pragma endregion
@@ -433,13 +1051,13 @@ namespace dae
 				Vector3 edgeV0V2 = positions[i2] - positions[i0];
 				Vector3 normal = Vector3::Cross(edgeV0V1, edgeV0V2);
 
-				if(isnan(normal.x))
+				if (std::isnan(normal.x))
 				{
 					int k = 0;
 				}
 
 				normal.Normalize();
-				if (isnan(normal.x))
+				if (std::isnan(normal.x))
 				{
 					int k = 0;
 				}
@@ -449,6 +1067,58 @@ namespace dae
 
 			return true;
 		}
+
+		//Saves RGBA8 pixels (bytes r, g, b, a in memory) as an uncompressed 24 bit bmp, returns true when it was written
+		static bool SaveBMP(const uint32_t* pPixels, int width, int height, const std::string& filename)
+		{
+			std::ofstream file(filename, std::ios::binary);
+			if (!file)
+				return false;
+
+			//Rows are stored bottom up, each padded to a multiple of 4 bytes
+			const uint32_t rowSize{ (static_cast<uint32_t>(width) * 3 + 3) & ~3u };
+			const uint32_t pixelDataSize{ rowSize * static_cast<uint32_t>(height) };
+			const uint32_t headerSize{ 14 + 40 };
+			const auto writeValue{ [&file](uint32_t value, int byteCount)
+				{
+					for (int byteIdx{}; byteIdx < byteCount; ++byteIdx)
+					{
+						file.put(static_cast<char>((value >> (8 * byteIdx)) & 0xFF));
+					}
+				} };
+
+			//File header
+			file.write("BM", 2);
+			writeValue(headerSize + pixelDataSize, 4);
+			writeValue(0, 4);
+			writeValue(headerSize, 4);
+			//Info header
+			writeValue(40, 4);
+			writeValue(static_cast<uint32_t>(width), 4);
+			writeValue(static_cast<uint32_t>(height), 4);
+			writeValue(1, 2); //Planes
+			writeValue(24, 2); //Bits per pixel
+			writeValue(0, 4); //No compression
+			writeValue(pixelDataSize, 4);
+			writeValue(2835, 4); //72 dpi
+			writeValue(2835, 4);
+			writeValue(0, 4);
+			writeValue(0, 4);
+
+			std::vector<char> row(rowSize);
+			for (int py{ height - 1 }; py >= 0; --py)
+			{
+				for (int px{}; px < width; ++px)
+				{
+					const uint32_t pixel{ pPixels[static_cast<size_t>(py) * width + px] };
+					row[px * 3] = static_cast<char>((pixel >> 16) & 0xFF);
+					row[px * 3 + 1] = static_cast<char>((pixel >> 8) & 0xFF);
+					row[px * 3 + 2] = static_cast<char>(pixel & 0xFF);
+				}
+				file.write(row.data(), rowSize);
+			}
+			return static_cast<bool>(file);
+		}
 #pragma warning(pop)
 	}
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "Vector3.h"
 
 #include <cassert>
+#include <cfloat>
 
 #include "Vector4.h"
 #include <cmath>
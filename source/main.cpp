@@ -1,31 +1,267 @@
+//Builds without a window and without SDL when defined, only the headless and benchmark modes remain (Linux render nodes)
+//#define HEADLESS_ONLY
+
 //External includes
+#if defined(_MSC_VER) && defined(_DEBUG)
 #include "vld.h"
+#endif
+#ifndef HEADLESS_ONLY
 #include "SDL.h"
 #include "SDL_surface.h"
 #undef main
+#endif
 
 //Standard includes
+#include <charconv>
+#include <chrono>
+#include <cstring>
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
 
 //Project includes
 #include "Timer.h"
 #include "Renderer.h"
+#include "BenchmarkSuite.h"
 #include "Scene.h"
+#include "RayStatistics.h"
+#include "Utils.h"
+#ifndef HEADLESS_ONLY
+#include "SDLPresenter.h"
+#endif
 
 using namespace dae;
 
+#ifndef HEADLESS_ONLY
 void ShutDown(SDL_Window* pWindow)
 {
 	SDL_DestroyWindow(pWindow);
 	SDL_Quit();
 }
+#endif
+
+namespace
+{
+	void PrintRayCounts(const RayStatistics::Counts& counts)
+	{
+		for (int i{}; i < static_cast<int>(RayStatistics::Counter::Count); ++i)
+		{
+			const RayStatistics::Counter counter{ static_cast<RayStatistics::Counter>(i) };
+			std::cout << " | " << RayStatistics::GetName(counter) << ": " << counts.Get(counter);
+		}
+	}
+
+	struct HeadlessSettings
+	{
+		std::string sceneName{ "W4_ReferenceScene" };
+		int width{ 640 };
+		int height{ 480 };
+		int frameCount{ 10 };
+		unsigned int threadCount{}; //0 uses one thread per hardware thread
+		std::string outputPath{}; //Empty doesn't save the last frame
+	};
+
+	void PrintUsage()
+	{
+		std::cout << "Usage: RayTracer [--headless | --benchmark] [options]\n"
+#ifndef HEADLESS_ONLY
+			"  (no arguments)     interactive window\n"
+#endif
+			"  --headless         renders a scene without a window and prints the frame times\n"
+			"  --benchmark        renders every scene and writes the results as JSON\n"
+			"Options:\n"
+			"  --scene <name>     ";
+		for (const std::string_view sceneName : GetSceneNames())
+		{
+			std::cout << sceneName << (sceneName == GetSceneNames().back() ? "\n" : ", ");
+		}
+		std::cout << "                     headless default W4_ReferenceScene, benchmark default all, can be repeated\n"
+			"  --width <pixels>   default 640\n"
+			"  --height <pixels>  default 480\n"
+			"  --frames <count>   headless default 10, benchmark default 20\n"
+			"  --warmup <count>   benchmark only, untimed frames before the timed ones, default 2\n"
+			"  --threads <count>  default 0, one per hardware thread\n"
+			"  --output <file>    headless: saves the last frame as a bmp, benchmark: JSON results, default benchmark.json\n";
+	}
+
+	//The whole text has to be a number
+	template<typename Integer>
+	bool ParseNumber(const char* text, Integer& value)
+	{
+		const char* const pEnd{ text + std::strlen(text) };
+		const auto [pLast, error] { std::from_chars(text, pEnd, value) };
+		return error == std::errc{} && pLast == pEnd;
+	}
+
+	//Options both modes take, returns false for any other option
+	template<typename Settings>
+	bool ParseCommonOption(std::string_view option, const char* value, Settings& settings, bool& isValid)
+	{
+		if (option == "--width")
+			isValid = ParseNumber(value, settings.width) && settings.width > 0;
+		else if (option == "--height")
+			isValid = ParseNumber(value, settings.height) && settings.height > 0;
+		else if (option == "--frames")
+			isValid = ParseNumber(value, settings.frameCount) && settings.frameCount > 0;
+		else if (option == "--threads")
+			isValid = ParseNumber(value, settings.threadCount);
+		else if (option == "--output")
+			settings.outputPath = value;
+		else
+			return false;
+		return true;
+	}
+
+	//Options follow the mode in args[1], every option takes a value. parseOption returns false for an unknown option.
+	template<typename ParseOption>
+	bool ParseCommandLine(int argc, char* args[], const ParseOption& parseOption)
+	{
+		for (int argIdx{ 2 }; argIdx < argc; ++argIdx)
+		{
+			const std::string_view option{ args[argIdx] };
+			if (argIdx + 1 == argc)
+			{
+				std::cerr << "Missing value for " << option << std::endl;
+				return false;
+			}
+			const char* const value{ args[++argIdx] };
+
+			bool isValid{ true };
+			if (!parseOption(option, value, isValid))
+			{
+				std::cerr << "Unknown option " << option << std::endl;
+				return false;
+			}
+			if (!isValid)
+			{
+				std::cerr << "Invalid value for " << option << ": " << value << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	//Renders a fixed number of frames without a window or input, the scene isn't updated so every frame traces the same image
+	int RunHeadless(const HeadlessSettings& settings)
+	{
+		const auto initStart{ std::chrono::high_resolution_clock::now() };
+		const auto pScene = CreateScene(settings.sceneName);
+		if (!pScene)
+		{
+			std::cerr << "Unknown scene " << settings.sceneName << std::endl;
+			PrintUsage();
+			return 1;
+		}
+		pScene->Initialize();
+		const auto initEnd{ std::chrono::high_resolution_clock::now() };
+		pScene->PrintBVHStatistics();
+
+		const auto pRenderer = new Renderer(settings.width, settings.height);
+		pRenderer->SetThreadCount(settings.threadCount);
+		std::vector<uint32_t> pixels(static_cast<size_t>(settings.width) * settings.height);
+
+		std::vector<float> frameTimes(settings.frameCount);
+		for (float& frameTime : frameTimes)
+		{
+			const auto start{ std::chrono::high_resolution_clock::now() };
+			pRenderer->Render(pScene, { pixels.data(), settings.width, PixelFormat::RGBA8 });
+			const auto end{ std::chrono::high_resolution_clock::now() };
+			frameTime = std::chrono::duration<float, std::milli>(end - start).count();
+		}
+
+		const FrameTimeStatistics statistics{ Timer::CalculateFrameTimeStatistics(frameTimes) };
+		std::cout << "Headless >> scene: " << settings.sceneName << " | " << settings.width << "x" << settings.height
+			<< " | threads: " << pRenderer->GetThreadCount() << " | frames: " << settings.frameCount << std::endl;
+		std::cout << "Scene init ms: " << std::chrono::duration<double, std::milli>(initEnd - initStart).count() << std::endl;
+		std::cout << "Frame ms >> avg: " << statistics.mean << " | min: " << statistics.min << " | p50: " << statistics.p50
+			<< " | p90: " << statistics.p90 << " | p99: " << statistics.p99 << " | max: " << statistics.max
+			<< " | stddev: " << statistics.standardDeviation << " | fps: " << 1000. / statistics.mean
+			<< " | Mpixels/s: " << static_cast<double>(settings.width) * settings.height / (statistics.mean * 1000.) << std::endl;
+		if constexpr (RayStatistics::isEnabled)
+		{
+			std::cout << "Last frame";
+			PrintRayCounts(pRenderer->GetRayCounts());
+			std::cout << std::endl;
+		}
+
+		int result{ 0 };
+		if (!settings.outputPath.empty())
+		{
+			if (Utils::SaveBMP(pixels.data(), settings.width, settings.height, settings.outputPath))
+				std::cout << "Last frame saved to " << settings.outputPath << std::endl;
+			else
+			{
+				std::cerr << "Something went wrong. Last frame not saved to " << settings.outputPath << std::endl;
+				result = 1;
+			}
+		}
+
+		delete pRenderer;
+		delete pScene;
+		return result;
+	}
+
+#ifndef HEADLESS_ONLY
+	//Keys and relative mouse movement since the previous call
+	CameraInput GetCameraInput()
+	{
+		const uint8_t* pKeyboardState = SDL_GetKeyboardState(nullptr);
+		CameraInput input{};
+		input.isShiftPressed = pKeyboardState[SDL_SCANCODE_LSHIFT] || pKeyboardState[SDL_SCANCODE_RSHIFT];
+		input.isForwardsPressed = pKeyboardState[SDL_SCANCODE_W] || pKeyboardState[SDL_SCANCODE_UP];
+		input.isBackwardsPressed = pKeyboardState[SDL_SCANCODE_S] || pKeyboardState[SDL_SCANCODE_DOWN];
+		input.isRightPressed = pKeyboardState[SDL_SCANCODE_D] || pKeyboardState[SDL_SCANCODE_RIGHT];
+		input.isLeftPressed = pKeyboardState[SDL_SCANCODE_A] || pKeyboardState[SDL_SCANCODE_LEFT];
+
+		const uint32_t mouseState = SDL_GetRelativeMouseState(&input.mouseX, &input.mouseY);
+		input.isLeftMousePressed = mouseState & SDL_BUTTON_LMASK;
+		input.isRightMousePressed = mouseState & SDL_BUTTON_RMASK;
+		return input;
+	}
+#endif
+}
 
 int main(int argc, char* args[])
 {
-	//Unreferenced parameters
-	(void)argc;
-	(void)args;
+	//Any argument selects a mode without a window
+	if (argc > 1)
+	{
+		const std::string_view mode{ args[1] };
+		if (mode == "--headless")
+		{
+			HeadlessSettings settings{};
+			const bool isValid{ ParseCommandLine(argc, args, [&settings](std::string_view option, const char* value, bool& isValid)
+				{
+					if (option != "--scene") return ParseCommonOption(option, value, settings, isValid);
+					settings.sceneName = value;
+					return true;
+				}) };
+			if (isValid) return RunHeadless(settings);
+		}
+		else if (mode == "--benchmark")
+		{
+			BenchmarkSettings settings{};
+			const bool isValid{ ParseCommandLine(argc, args, [&settings](std::string_view option, const char* value, bool& isValid)
+				{
+					if (option == "--scene")
+						settings.sceneNames.emplace_back(value);
+					else if (option == "--warmup")
+						isValid = ParseNumber(value, settings.warmupFrames) && settings.warmupFrames >= 0;
+					else
+						return ParseCommonOption(option, value, settings, isValid);
+					return true;
+				}) };
+			if (isValid) return RunBenchmarkSuite(settings) ? 0 : 1;
+		}
+		PrintUsage();
+		return 1;
+	}
 
+#ifdef HEADLESS_ONLY
+	PrintUsage();
+	return 1;
+#else
 	//Create window + surfaces
 	SDL_Init(SDL_INIT_VIDEO);
 
@@ -43,10 +279,12 @@ int main(int argc, char* args[])
 
 	//Initialize "framework"
 	const auto pTimer = new Timer();
-	const auto pRenderer = new Renderer(pWindow);
+	const auto pRenderer = new Renderer(width, height);
+	const auto pPresenter = new SDLPresenter(pWindow);
 
 	const auto pScene = new Scene_W4_ReferenceScene();
 	pScene->Initialize();
+	pScene->PrintBVHStatistics();
 
 	//Start loop
 	pTimer->Start();
@@ -76,19 +314,38 @@ int main(int argc, char* args[])
 				case SDL_SCANCODE_F3:
 					pRenderer->CycleLightingMode();
 					break;
+				case SDL_SCANCODE_F4:
+					pScene->CycleBVHLayout();
+					break;
+				case SDL_SCANCODE_F5:
+					pScene->BenchmarkBVHBuild();
+					break;
 				case SDL_SCANCODE_F6:
 					pTimer->StartBenchmark();
 					break;
+				case SDL_SCANCODE_F7:
+					pScene->OptimizeBVHLayout(width, height);
+					break;
+				case SDL_SCANCODE_F8:
+					pScene->BenchmarkBVHLayout(width, height);
+					break;
+				case SDL_SCANCODE_F9:
+					pRenderer->CycleRenderMode();
+					break;
+				case SDL_SCANCODE_F10:
+					pScene->BenchmarkTriangleTests();
+					break;
 				}
 				break;
 			}
 		}
 
 		//--------- Update ---------
+		pScene->GetCamera().Update(pTimer->GetElapsed(), GetCameraInput());
 		pScene->Update(pTimer);
 
 		//--------- Render ---------
-		pRenderer->Render(pScene);
+		pPresenter->Render(*pRenderer, pScene);
 
 		//--------- Timer ---------
 		pTimer->Update();
@@ -96,13 +353,18 @@ int main(int argc, char* args[])
 		if (printTimer >= 1.f)
 		{
 			printTimer = 0.f;
-			std::cout << "dFPS: " << pTimer->GetdFPS() << std::endl;
+			std::cout << "dFPS: " << pTimer->GetdFPS();
+			if constexpr (RayStatistics::isEnabled)
+			{
+				PrintRayCounts(pRenderer->GetRayCounts());
+			}
+			std::cout << std::endl;
 		}
 
 		//Save screenshot after full render
 		if (takeScreenshot)
 		{
-			if (!pRenderer->SaveBufferToImage())
+			if (pPresenter->SaveBufferToImage())
 				std::cout << "Screenshot saved!" << std::endl;
 			else
 				std::cout << "Something went wrong. Screenshot not saved!" << std::endl;
@@ -113,9 +375,11 @@ int main(int argc, char* args[])
 
 	//Shutdown "framework"
 	delete pScene;
+	delete pPresenter;
 	delete pRenderer;
 	delete pTimer;
 
 	ShutDown(pWindow);
 	return 0;
+#endif
 }
\ No newline at end of file